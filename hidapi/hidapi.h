@@ -79,6 +79,32 @@ extern "C" {
 			struct hid_device_info *next;
 		};
 
+		/** When an Input report arrived, from hid_read_ex() */
+		struct hid_report_info {
+			/** Arrival time in nanoseconds of the monotonic clock
+			    (CLOCK_MONOTONIC where there is one) */
+			unsigned long long timestamp;
+			/** Number of the report, counted per device from 0.
+			    libusb and Mac number the reports as they arrive,
+			    so a gap means the queue was full and reports were
+			    dropped before they were read. hidraw and Windows
+			    number them as they are read, so there are no gaps
+			    and reports dropped by the system do not show. */
+			unsigned int sequence;
+		};
+
+		/** one report slot of hid_read_batch() */
+		struct hid_report_slot {
+			/** Buffer to read the report into */
+			unsigned char *data;
+			/** Size of the buffer */
+			size_t length;
+			/** Number of bytes read into the buffer */
+			int bytes_read;
+			/** When the report arrived */
+			struct hid_report_info info;
+		};
+
 
 		/** @brief Initialize the HIDAPI library.
 
@@ -256,6 +282,78 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *device, unsigned char *data, size_t length);
 
+		/** @brief Read an Input report with its arrival time, with timeout.
+
+			Reads like hid_read_timeout(), and also returns when the
+			report arrived and its sequence number. The time is taken
+			as close to the arrival as the backend can: when the
+			transfer completes for libusb, when IOKit delivers the
+			report on Mac, when the completed overlapped read is
+			collected on Windows and when poll() wakes up for
+			hidraw. On hidraw and Windows the system drops reports
+			without telling when its queue is full, which does not
+			show in the sequence numbers.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param data A buffer to put the read data into.
+			@param length The number of bytes to read. For devices with
+				multiple reports, make sure to read an extra byte for
+				the report number.
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+			@param info Set to the arrival of the report when one is
+				read, may be NULL.
+
+			@returns
+				This function returns the actual number of bytes read and
+				-1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_timeout_ex(hid_device *dev, unsigned char *data, size_t length, int milliseconds, struct hid_report_info *info);
+
+		/** @brief Read an Input report with its arrival time.
+
+			Reads like hid_read(), see hid_read_timeout_ex().
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data A buffer to put the read data into.
+			@param length The number of bytes to read. For devices with
+				multiple reports, make sure to read an extra byte for
+				the report number.
+			@param info Set to the arrival of the report when one is
+				read, may be NULL.
+
+			@returns
+				This function returns the actual number of bytes read and
+				-1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_ex(hid_device *device, unsigned char *data, size_t length, struct hid_report_info *info);
+
+		/** @brief Read all Input reports that are waiting, with one wait.
+
+			Waits like hid_read_timeout() for the first report, then
+			reads every report that is already queued for the device,
+			without waiting again, into the following slots. Each
+			report is read into its own slot, the same way as with
+			hid_read_timeout_ex(). On hidraw the first call makes
+			the file descriptor non-blocking for good, which
+			hid_read() and hid_read_timeout() work with as before.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param slots The buffers to read the reports into; the
+				number of bytes read into each one is set in it.
+			@param num_slots The number of slots, the most reports
+				that are read.
+			@param milliseconds timeout in milliseconds for the first
+				report or -1 for blocking wait.
+
+			@returns
+				This function returns the number of reports read, 0
+				on timeout and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_batch(hid_device *device, struct hid_report_slot *slots, int num_slots, int milliseconds);
+
 		/** @brief Set the device handle to be non-blocking.
 
 			In non-blocking mode calls to hid_read() will return
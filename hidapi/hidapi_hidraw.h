@@ -0,0 +1,166 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Alan Ott
+ Signal 11 Software
+
+ 8/22/2009
+
+ Copyright 2009, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+/** @file
+ * @defgroup API_HIDRAW hidapi API for the Linux hidraw backend
+ */
+
+#ifndef HIDAPI_HIDRAW_H__
+#define HIDAPI_HIDRAW_H__
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+		/** @brief Read a device with a single read() per call.
+
+			Makes the file descriptor of the device non-blocking,
+			as if the node had been opened with O_NONBLOCK. From
+			then on hid_read() and hid_read_timeout() read first,
+			and only poll() when there is no report yet and the
+			call is to wait for one, so a non-blocking read costs
+			one system call instead of two.
+
+			A disconnect shows as ENODEV from read(). Some kernels
+			return EAGAIN for a device that is gone instead; for
+			those, a udev monitor shared by all devices in this
+			mode is looked at, at most every 100 ms, when a read
+			finds nothing. Without udev only ENODEV is seen.
+
+			@ingroup API_HIDRAW
+			@param device A device handle returned from hid_open().
+			@param enable 1 to use fast reads, 0 to stop using them.
+				The descriptor stays non-blocking.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_fast_read(hid_device *device, int enable);
+
+		struct hid_read_engine;
+
+		/** A report read by a hid_read_engine */
+		struct hid_read_completion {
+			/** The device the report was read from */
+			hid_device *device;
+			/** The user data the device was added with */
+			void *user_data;
+			/** The report, valid until the next call to
+			    hid_read_engine_wait() */
+			const unsigned char *data;
+			/** Number of bytes read, -1 when the device was
+			    disconnected; it is not read again then */
+			int bytes_read;
+			/** When the report arrived, as with hid_read_ex();
+			    all zero when no report was read */
+			struct hid_report_info info;
+		};
+
+		/** @brief Create an engine that reads many devices at once.
+
+			The engine keeps a read in flight on every device added
+			to it, using io_uring where the kernel supports it and
+			epoll otherwise.
+
+			@ingroup API_HIDRAW
+			@param max_devices The most devices that can be added.
+
+			@returns
+				This function returns a pointer to the engine, or NULL
+				on error.
+		*/
+		struct hid_read_engine HID_API_EXPORT * HID_API_CALL hid_read_engine_new(int max_devices);
+
+		/** @brief Add a device to a read engine.
+
+			Without io_uring the file descriptor of the device is
+			made non-blocking; hid_read() and hid_read_timeout()
+			still work as before once the device is removed again. Remove the device
+			before closing it.
+
+			@ingroup API_HIDRAW
+			@param engine An engine returned from hid_read_engine_new().
+			@param device A device handle returned from hid_open().
+			@param length The size of the largest report, including
+				the report number.
+			@param user_data Passed back with each report.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_engine_add(struct hid_read_engine *engine, hid_device *device, size_t length, void *user_data);
+
+		/** @brief Remove a device from a read engine.
+
+			@ingroup API_HIDRAW
+			@param engine An engine returned from hid_read_engine_new().
+			@param device A device added to the engine.
+
+			@returns
+				This function returns 0 on success and -1 if the
+				device was not added.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_engine_remove(struct hid_read_engine *engine, hid_device *device);
+
+		/** @brief Wait for reports from the devices of a read engine.
+
+			Returns the reports that have been read since the last
+			call, waiting for the first one if there are none. The
+			devices of the returned reports are read again on the
+			next call.
+
+			@ingroup API_HIDRAW
+			@param engine An engine returned from hid_read_engine_new().
+			@param completions Array to put the reports into.
+			@param max_completions The size of the array.
+			@param milliseconds timeout in milliseconds or -1 for
+				blocking wait.
+
+			@returns
+				This function returns the number of reports, 0 on
+				timeout and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_engine_wait(struct hid_read_engine *engine, struct hid_read_completion *completions, int max_completions, int milliseconds);
+
+		/** @brief Whether a read engine uses io_uring (1) or epoll (0).
+
+			@ingroup API_HIDRAW
+			@param engine An engine returned from hid_read_engine_new().
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_engine_uses_io_uring(struct hid_read_engine *engine);
+
+		/** @brief Stop all reads and free a read engine.
+
+			The devices are not closed.
+
+			@ingroup API_HIDRAW
+			@param engine An engine returned from hid_read_engine_new().
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_read_engine_free(struct hid_read_engine *engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -37,6 +37,7 @@
 
 #include <hidapi.h>
 #include <hidapi_parser.h>
+#include <hid_reactor.h>
 
 // Headers needed for sleeping.
 #ifdef _WIN32
@@ -45,14 +46,25 @@
 	#include <unistd.h>
 #endif
 
+#include <pthread.h>
+
 
 #include <map>
+#include <vector>
 
 typedef std::map<int, hid_dev_desc* > hid_map_t;
 
 hid_map_t hiddevices;    // declares a vector of integers
 int number_of_hids = 0;
 
+// the main loop waits on the open devices with the reactor, and is the only thread that uses it;
+// the osc thread opens devices and queues them to be added, queues devices to be closed, and
+// wakes the reactor. The lock is held while reports are handled and while the queues change.
+struct hid_reactor * reactor;
+pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+std::vector<hid_dev_desc*> devices_to_add;
+std::vector<hid_dev_desc*> devices_to_close;
+
 int done = 0;
 
 #define MAX_STR 255
@@ -62,15 +74,15 @@ lo_address t;
 lo_server s;
 lo_server_thread st;
 
-static void osc_element_cb( struct hid_device_element *el, void *data)
+static void osc_element_cb( const struct hid_device_element *el, int value, void *data)
 {
   lo_message m1 = lo_message_new();
   lo_message_add_int32( m1, *((int*) data) );
   lo_message_add_int32( m1, el->index );
   lo_message_add_int32( m1, el->usage_page );
   lo_message_add_int32( m1, el->usage );
-  lo_message_add_int32( m1, el->value );
-  lo_message_add_float( m1, hid_element_map_logical( el ) ); // TODO: this one is not found???
+  lo_message_add_int32( m1, value );
+  lo_message_add_float( m1, hid_element_map_logical( el, value ) ); // TODO: this one is not found???
   lo_send_message_from( t, s, "/hid/element/data", m1 );
   lo_message_free(m1);
 }
@@ -84,13 +96,56 @@ static void osc_descriptor_cb( struct hid_dev_desc *dd, void *data)
   lo_message_free(m1);
 }
 
+// reads all reports the device has waiting
+static void hid_ready_cb( hid_device *device, void *user_data )
+{
+  struct hid_dev_desc * devdesc = (struct hid_dev_desc *) user_data;
+  unsigned char buf[256];
+  int res;
+  pthread_mutex_lock( &devices_lock );
+  while ( ( res = hid_read_timeout( device, buf, sizeof(buf), 0 ) ) > 0 ){
+    hid_parse_input_report( buf, res, devdesc );
+  }
+  pthread_mutex_unlock( &devices_lock );
+  if ( res < 0 ){
+    // unplugged: stop waiting on it, it stays open until /hid/close
+    fprintf(stderr, "Unable to read device %d\n", devdesc->index );
+    hid_reactor_remove( reactor, device );
+  }
+}
+
+// called from the main loop: adds the opened devices to the reactor, and closes the closed ones
+void update_devices(){
+  std::vector<hid_dev_desc*> added;
+  size_t i;
+  pthread_mutex_lock( &devices_lock );
+  added.swap( devices_to_add );
+  pthread_mutex_unlock( &devices_lock );
+  for ( i = 0; i < added.size(); i++ ){
+    hid_reactor_add( reactor, added[i]->device, hid_ready_cb, added[i] );
+    // read what is waiting already; on Windows this also starts the read that the reactor waits on
+    hid_ready_cb( added[i]->device, added[i] );
+  }
+  pthread_mutex_lock( &devices_lock );
+  for ( i = 0; i < devices_to_close.size(); i++ ){
+    hid_reactor_remove( reactor, devices_to_close[i]->device );
+    hid_close_device( devices_to_close[i] );
+  }
+  devices_to_close.clear();
+  pthread_mutex_unlock( &devices_lock );
+}
+
 void close_all_devices(){
   hid_map_t::const_iterator it;
+  update_devices();
+  pthread_mutex_lock( &devices_lock );
   for(it=hiddevices.begin(); it!=hiddevices.end(); ++it){
     struct hid_dev_desc * devdesc = it->second;
+    hid_reactor_remove( reactor, devdesc->device );
     hid_close_device( devdesc );
   }
   hiddevices.clear();
+  pthread_mutex_unlock( &devices_lock );
 }
 
 void open_device( unsigned short vendor, unsigned short product, const wchar_t *serial_number=NULL  ){
@@ -106,6 +161,7 @@ void open_device( unsigned short vendor, unsigned short product, const wchar_t *
     }
     return;
   } else {      
+    pthread_mutex_lock( &devices_lock );
     hiddevices[ number_of_hids ] = newdevdesc;    
     if ( serial_number != NULL ){
       lo_send_from( t, s, LO_TT_IMMEDIATE, "/hid/open", "iiis", number_of_hids, product, vendor, serial_number );
@@ -116,9 +172,12 @@ void open_device( unsigned short vendor, unsigned short product, const wchar_t *
     newdevdesc->index = number_of_hids;
     
     hid_set_descriptor_callback( newdevdesc, (hid_descriptor_callback) osc_descriptor_cb, &newdevdesc->index );
-    hid_set_element_callback( newdevdesc, (hid_element_callback) osc_element_cb, &newdevdesc->index );  
+    hid_set_element_callback( newdevdesc, osc_element_cb, &newdevdesc->index );  
+    devices_to_add.push_back( newdevdesc );
 
     number_of_hids++;
+    pthread_mutex_unlock( &devices_lock );
+    hid_reactor_wake( reactor );
   }
 }
 
@@ -129,8 +188,11 @@ void close_device( int joy_idx ){
     lo_send_from( t, s, LO_TT_IMMEDIATE, "/hid/close/error", "i", joy_idx );
   } else {
     lo_send_from( t, s, LO_TT_IMMEDIATE, "/hid/closed", "iii", joy_idx, hidtoclose->info->vendor_id, hidtoclose->info->product_id );
-    hid_close_device( hidtoclose );
+    pthread_mutex_lock( &devices_lock );
+    devices_to_close.push_back( hidtoclose );
     hiddevices.erase( joy_idx );
+    pthread_mutex_unlock( &devices_lock );
+    hid_reactor_wake( reactor );
   }
 }
 
@@ -145,14 +207,9 @@ void set_element_output( int joy_idx, int elementid, int value ){
   
   if ( devd != NULL ){
     // find the right output element
-    struct hid_device_collection * device_collection = devd->device_collection;
-    struct hid_device_element * cur_element = device_collection->first_element;
-    
-    while ( (cur_element->io_type != 2 || (cur_element->index != elementid)) && cur_element != NULL ){
-	cur_element = hid_get_next_output_element(cur_element);
-    }
-    if ( cur_element != NULL ){
-	cur_element->value = value;
+    struct hid_device_element * cur_element = hid_get_element( devd, elementid );
+    if ( cur_element != NULL && cur_element->io_type == 2 ){
+      hid_set_output_value( devd, cur_element, value );
     }
   }  
 }
@@ -350,6 +407,7 @@ int quit_handler(const char *path, const char *types, lo_arg **argv, int argc,
 		 void *data, void *user_data)
 {
     done = 1;
+    hid_reactor_wake( reactor );
     printf("hidapi2osc: allright, that's it, I quit\n");
     fflush(stdout);
 
@@ -370,12 +428,10 @@ void send_elements_hid_info(int joy_idx)
   lo_message_add_int32( m1, hid->device_collection->num_elements );
   lo_bundle_add_message( b, "/hid/element/number", m1 );
 
-  hid_device_element * cur_element = hid->device_collection->first_element;
-  
-  while (cur_element) {
-    lo_message m2 = get_hid_element_info_msg( cur_element, joy_idx );
+  int i;
+  for ( i = 0; i < hid->device_collection->num_elements; i++ ) {
+    lo_message m2 = get_hid_element_info_msg( &hid->elements[ i ], joy_idx );
     lo_bundle_add_message( b, "/hid/element/info", m2 );
-    cur_element = cur_element->next;
   }
 
   if ( lo_send_bundle_from( t, s, b )  == -1 ){
@@ -605,6 +661,10 @@ int main(int argc, char** argv)
 	outport = argv[2];
 	}
   
+      reactor = hid_reactor_new();
+      if ( reactor == NULL )
+	return -1;
+
       init_osc( ip, outport, port );
 
       if (hid_init())
@@ -612,23 +672,14 @@ int main(int argc, char** argv)
     
       printf("Entering hid read loop, press Ctrl-c to exit\n");
 
-      int res = 0;
-      hid_map_t::const_iterator it;
-      unsigned char buf[256];
+      // reports are handled as soon as they arrive; the osc thread wakes the loop
+      // when devices are opened or closed, and when it should quit
       while(!done){
-	for(it=hiddevices.begin(); it!=hiddevices.end(); ++it){
-	  res = hid_read( it->second->device, buf, sizeof(buf));
-	  if ( res > 0 ) {
-	    hid_parse_input_report( buf, res, it->second );
-	  }
-	}
-	#ifdef WIN32
-	Sleep(50);
-	#else
-	usleep(500*10);
-	#endif
+	hid_reactor_wait( reactor, NULL, 0, -1 );
+	update_devices();
       }
       close_all_devices();
+      hid_reactor_free( reactor );
 	  
       lo_send_from( t, s, LO_TT_IMMEDIATE, "/hidapi2osc/quit", "s", "nothing more to do, quitting" );
       lo_server_thread_free( st );
@@ -0,0 +1,406 @@
+/* hidapi_parser $
+ *
+ * Copyright (C) 2013, Marije Baalman <nescivi _at_ gmail.com>
+ * This work was funded by a crowd-funding initiative for SuperCollider's [1] HID implementation
+ * including a substantial donation from BEK, Bergen Center for Electronic Arts, Norway
+ *
+ * [1] http://supercollider.sourceforge.net
+ * [2] http://www.bek.no
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#elif defined(__linux__)
+	#include <errno.h>
+	#include <unistd.h>
+	#include <poll.h>
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+#else
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <poll.h>
+#endif
+
+#include "hid_reactor.h"
+
+struct hid_reactor_device {
+  hid_device * device;
+  hid_reactor_callback callback;
+  void * user_data;
+  // removed from within a callback; freed when hid_reactor_wait returns
+  int removed;
+};
+
+struct hid_reactor {
+  // separately allocated, so that the pointers handed to epoll stay valid when the array grows
+  struct hid_reactor_device ** devices;
+  int number_of_devices;
+  int max_devices;
+  // set while hid_reactor_wait calls the callbacks
+  int dispatching;
+  int number_removed;
+
+  // the devices waited on, as the backend returns them
+  struct hid_reactor_device ** ready;
+  // hid_reactor_wake signals it, it is waited on after the devices
+#ifdef _WIN32
+  HANDLE wake_event;
+  HANDLE handles[ MAXIMUM_WAIT_OBJECTS ];
+#elif defined(__linux__)
+  int wake_fd;
+  int epoll_fd;
+  struct epoll_event * events;
+#else
+  int wake_pipe[2];
+  struct pollfd * fds;
+#endif
+};
+
+static int hid_reactor_find( struct hid_reactor * reactor, hid_device * device ){
+  int i;
+  for ( i = 0; i < reactor->number_of_devices; i++ ){
+    if ( reactor->devices[i]->device == device && !reactor->devices[i]->removed ){
+      return i;
+    }
+  }
+  return -1;
+}
+
+// frees the devices that were removed while the callbacks ran
+static void hid_reactor_compact( struct hid_reactor * reactor ){
+  int i, j = 0;
+  for ( i = 0; i < reactor->number_of_devices; i++ ){
+    if ( reactor->devices[i]->removed ){
+      free( reactor->devices[i] );
+    } else {
+      reactor->devices[ j++ ] = reactor->devices[i];
+    }
+  }
+  reactor->number_of_devices = j;
+  reactor->number_removed = 0;
+}
+
+static int hid_reactor_grow( struct hid_reactor * reactor );
+
+struct hid_reactor * hid_reactor_new( void ){
+  struct hid_reactor * reactor = (struct hid_reactor *) calloc( 1, sizeof( struct hid_reactor ) );
+  if ( reactor == NULL ){
+    return NULL;
+  }
+#ifdef _WIN32
+  reactor->wake_event = CreateEvent( NULL, FALSE, FALSE, NULL );
+  if ( reactor->wake_event == NULL ){
+    free( reactor );
+    return NULL;
+  }
+#elif defined(__linux__)
+  reactor->wake_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+  reactor->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+  if ( reactor->wake_fd >= 0 && reactor->epoll_fd >= 0 ){
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // the wake fd, devices have their entry here
+    if ( epoll_ctl( reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &event ) != 0 ){
+      close( reactor->epoll_fd );
+      reactor->epoll_fd = -1;
+    }
+  }
+  if ( reactor->wake_fd < 0 || reactor->epoll_fd < 0 ){
+    if ( reactor->wake_fd >= 0 ){ close( reactor->wake_fd ); }
+    if ( reactor->epoll_fd >= 0 ){ close( reactor->epoll_fd ); }
+    free( reactor );
+    return NULL;
+  }
+#else
+  if ( pipe( reactor->wake_pipe ) != 0 ){
+    free( reactor );
+    return NULL;
+  }
+  fcntl( reactor->wake_pipe[0], F_SETFL, O_NONBLOCK );
+  fcntl( reactor->wake_pipe[1], F_SETFL, O_NONBLOCK );
+  fcntl( reactor->wake_pipe[0], F_SETFD, FD_CLOEXEC );
+  fcntl( reactor->wake_pipe[1], F_SETFD, FD_CLOEXEC );
+#endif
+  // room for the wake handle also when no devices are added
+  if ( hid_reactor_grow( reactor ) != 0 ){
+    hid_reactor_free( reactor );
+    return NULL;
+  }
+  return reactor;
+}
+
+void hid_reactor_free( struct hid_reactor * reactor ){
+  int i;
+  if ( reactor == NULL ){
+    return;
+  }
+  for ( i = 0; i < reactor->number_of_devices; i++ ){
+    free( reactor->devices[i] );
+  }
+  free( reactor->devices );
+  free( reactor->ready );
+#ifdef _WIN32
+  CloseHandle( reactor->wake_event );
+#elif defined(__linux__)
+  close( reactor->epoll_fd );
+  close( reactor->wake_fd );
+  free( reactor->events );
+#else
+  close( reactor->wake_pipe[0] );
+  close( reactor->wake_pipe[1] );
+  free( reactor->fds );
+#endif
+  free( reactor );
+}
+
+void hid_reactor_wake( struct hid_reactor * reactor ){
+#ifdef _WIN32
+  SetEvent( reactor->wake_event );
+#elif defined(__linux__)
+  uint64_t one = 1;
+  // only fails when the counter is full, then a wake is pending anyway
+  if ( write( reactor->wake_fd, &one, sizeof( one ) ) < 0 ){
+    return;
+  }
+#else
+  char byte = 0;
+  // only fails when the pipe is full, then a wake is pending anyway
+  if ( write( reactor->wake_pipe[1], &byte, 1 ) < 0 ){
+    return;
+  }
+#endif
+}
+
+// takes the pending wakes, so that the next wait blocks again
+static void hid_reactor_clear_wake( struct hid_reactor * reactor ){
+#if !defined(_WIN32) && defined(__linux__)
+  uint64_t count;
+  if ( read( reactor->wake_fd, &count, sizeof( count ) ) < 0 ){
+    return;
+  }
+#elif !defined(_WIN32)
+  char bytes[64];
+  while ( read( reactor->wake_pipe[0], bytes, sizeof( bytes ) ) > 0 ){
+  }
+#else
+  (void) reactor; // the event resets itself when the wait returns it
+#endif
+}
+
+// makes room for one more device in the arrays that have an entry per device
+static int hid_reactor_grow( struct hid_reactor * reactor ){
+  int max_devices;
+  void * grown;
+
+  if ( reactor->number_of_devices < reactor->max_devices ){
+    return 0;
+  }
+  max_devices = reactor->max_devices > 0 ? 2 * reactor->max_devices : 8;
+#ifdef _WIN32
+  if ( max_devices > MAXIMUM_WAIT_OBJECTS - 1 ){
+    max_devices = MAXIMUM_WAIT_OBJECTS - 1; // one handle is the wake event
+  }
+  if ( max_devices <= reactor->number_of_devices ){
+    return -1;
+  }
+#endif
+  grown = realloc( reactor->devices, max_devices * sizeof( struct hid_reactor_device * ) );
+  if ( grown == NULL ){
+    return -1;
+  }
+  reactor->devices = (struct hid_reactor_device **) grown;
+  grown = realloc( reactor->ready, max_devices * sizeof( struct hid_reactor_device * ) );
+  if ( grown == NULL ){
+    return -1;
+  }
+  reactor->ready = (struct hid_reactor_device **) grown;
+#if !defined(_WIN32) && defined(__linux__)
+  grown = realloc( reactor->events, max_devices * sizeof( struct epoll_event ) );
+  if ( grown == NULL ){
+    return -1;
+  }
+  reactor->events = (struct epoll_event *) grown;
+#elif !defined(_WIN32)
+  grown = realloc( reactor->fds, ( max_devices + 1 ) * sizeof( struct pollfd ) );
+  if ( grown == NULL ){
+    return -1;
+  }
+  reactor->fds = (struct pollfd *) grown;
+#endif
+  reactor->max_devices = max_devices;
+  return 0;
+}
+
+int hid_reactor_add( struct hid_reactor * reactor, hid_device * device, hid_reactor_callback callback, void * user_data ){
+  struct hid_reactor_device * entry;
+
+  if ( reactor == NULL || device == NULL || hid_reactor_find( reactor, device ) >= 0 ){
+    return -1;
+  }
+  if ( hid_reactor_grow( reactor ) != 0 ){
+    return -1;
+  }
+  entry = (struct hid_reactor_device *) calloc( 1, sizeof( struct hid_reactor_device ) );
+  if ( entry == NULL ){
+    return -1;
+  }
+  entry->device = device;
+  entry->callback = callback;
+  entry->user_data = user_data;
+
+#if !defined(_WIN32) && defined(__linux__)
+  {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = entry;
+    if ( epoll_ctl( reactor->epoll_fd, EPOLL_CTL_ADD, (int) (intptr_t) hid_get_event_handle( device ), &event ) != 0 ){
+      free( entry );
+      return -1;
+    }
+  }
+#endif
+  reactor->devices[ reactor->number_of_devices++ ] = entry;
+  return 0;
+}
+
+int hid_reactor_remove( struct hid_reactor * reactor, hid_device * device ){
+  int index;
+
+  if ( reactor == NULL ){
+    return -1;
+  }
+  index = hid_reactor_find( reactor, device );
+  if ( index < 0 ){
+    return -1;
+  }
+#if !defined(_WIN32) && defined(__linux__)
+  epoll_ctl( reactor->epoll_fd, EPOLL_CTL_DEL, (int) (intptr_t) hid_get_event_handle( device ), NULL );
+#endif
+  reactor->devices[ index ]->removed = 1;
+  reactor->number_removed++;
+  if ( !reactor->dispatching ){
+    hid_reactor_compact( reactor );
+  }
+  return 0;
+}
+
+// waits for at most limit ready devices and puts them in reactor->ready
+static int hid_reactor_poll( struct hid_reactor * reactor, int limit, int milliseconds ){
+  int i;
+  int count = 0;
+#ifdef _WIN32
+  DWORD timeout = milliseconds < 0 ? INFINITE : (DWORD) milliseconds;
+  DWORD wait;
+
+  for ( i = 0; i < reactor->number_of_devices; i++ ){
+    reactor->handles[i] = (HANDLE) hid_get_event_handle( reactor->devices[i]->device );
+  }
+  reactor->handles[ reactor->number_of_devices ] = reactor->wake_event;
+  wait = WaitForMultipleObjects( reactor->number_of_devices + 1, reactor->handles, FALSE, timeout );
+  if ( wait == WAIT_TIMEOUT || wait == WAIT_OBJECT_0 + reactor->number_of_devices ){
+    return 0;
+  }
+  if ( wait > WAIT_OBJECT_0 + reactor->number_of_devices ){
+    return -1;
+  }
+  // the wait returns the first signalled handle, the ones after it may be signalled as well
+  for ( i = (int) ( wait - WAIT_OBJECT_0 ); i < reactor->number_of_devices && count < limit; i++ ){
+    if ( WaitForSingleObject( reactor->handles[i], 0 ) == WAIT_OBJECT_0 ){
+      reactor->ready[ count++ ] = reactor->devices[i];
+    }
+  }
+#elif defined(__linux__)
+  int res = epoll_wait( reactor->epoll_fd, reactor->events, limit > 0 ? limit : 1, milliseconds );
+  if ( res < 0 ){
+    return errno == EINTR ? 0 : -1;
+  }
+  for ( i = 0; i < res; i++ ){
+    if ( reactor->events[i].data.ptr == NULL ){
+      hid_reactor_clear_wake( reactor );
+    } else {
+      reactor->ready[ count++ ] = (struct hid_reactor_device *) reactor->events[i].data.ptr;
+    }
+  }
+#else
+  for ( i = 0; i < reactor->number_of_devices; i++ ){
+    reactor->fds[i].fd = (int) (intptr_t) hid_get_event_handle( reactor->devices[i]->device );
+    reactor->fds[i].events = POLLIN;
+    reactor->fds[i].revents = 0;
+  }
+  reactor->fds[ reactor->number_of_devices ].fd = reactor->wake_pipe[0];
+  reactor->fds[ reactor->number_of_devices ].events = POLLIN;
+  reactor->fds[ reactor->number_of_devices ].revents = 0;
+  int res = poll( reactor->fds, reactor->number_of_devices + 1, milliseconds );
+  if ( res < 0 ){
+    return errno == EINTR ? 0 : -1;
+  }
+  if ( reactor->fds[ reactor->number_of_devices ].revents != 0 ){
+    hid_reactor_clear_wake( reactor );
+  }
+  for ( i = 0; i < reactor->number_of_devices && count < limit; i++ ){
+    if ( reactor->fds[i].revents != 0 ){
+      reactor->ready[ count++ ] = reactor->devices[i];
+    }
+  }
+#endif
+  return count;
+}
+
+int hid_reactor_wait( struct hid_reactor * reactor, hid_device ** ready, int max_ready, int milliseconds ){
+  int i, count;
+  int limit;
+  int number_ready = 0;
+
+  if ( reactor == NULL || ( ready != NULL && max_ready <= 0 ) ){
+    return -1;
+  }
+  limit = reactor->number_of_devices;
+  if ( ready != NULL && max_ready < limit ){
+    limit = max_ready;
+  }
+
+  count = hid_reactor_poll( reactor, limit, milliseconds );
+  if ( count <= 0 ){
+    return count;
+  }
+
+  // a callback may remove devices that are further on in the list, they are skipped
+  reactor->dispatching = 1;
+  for ( i = 0; i < count; i++ ){
+    struct hid_reactor_device * entry = reactor->ready[i];
+    if ( entry->removed ){
+      continue;
+    }
+    if ( ready != NULL ){
+      ready[ number_ready ] = entry->device;
+    }
+    number_ready++;
+    if ( entry->callback != NULL ){
+      entry->callback( entry->device, entry->user_data );
+    }
+  }
+  reactor->dispatching = 0;
+  if ( reactor->number_removed > 0 ){
+    hid_reactor_compact( reactor );
+  }
+  return number_ready;
+}
@@ -0,0 +1,71 @@
+/* hidapi_parser $
+ *
+ * Copyright (C) 2013, Marije Baalman <nescivi _at_ gmail.com>
+ * This work was funded by a crowd-funding initiative for SuperCollider's [1] HID implementation
+ * including a substantial donation from BEK, Bergen Center for Electronic Arts, Norway
+ *
+ * [1] http://supercollider.sourceforge.net
+ * [2] http://www.bek.no
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef HID_REACTOR_H__
+#define HID_REACTOR_H__
+
+#ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
+extern "C" {
+#endif
+
+#include <hidapi.h>
+
+// A reactor waits on many devices at once, on the handles of hid_get_event_handle: one epoll
+// instance on Linux, poll() on other unix systems and WaitForMultipleObjects on Windows.
+// Readiness is level triggered: a device stays ready until the reports queued for it are read.
+// A reactor is used from one thread; only hid_reactor_wake may be called from any thread.
+
+struct hid_reactor;
+
+/** called from hid_reactor_wait for a ready device; it should read the reports of the device,
+ *  and may remove the device from the reactor, e.g. when the read fails */
+typedef void (*hid_reactor_callback) ( hid_device *device, void *user_data );
+
+struct hid_reactor * hid_reactor_new( void );
+/** frees the reactor, the devices are not closed */
+void hid_reactor_free( struct hid_reactor * reactor );
+
+/** adds a device, with a callback (may be NULL) for when it is ready; returns 0, or -1 on error
+ *  or if the device was added before. On Windows a device only becomes ready while a read is
+ *  pending on it, i.e. after hid_read_timeout has returned 0 for it, and at most
+ *  MAXIMUM_WAIT_OBJECTS - 1 devices can be added */
+int hid_reactor_add( struct hid_reactor * reactor, hid_device * device, hid_reactor_callback callback, void * user_data );
+/** removes a device, also from within a callback; remove a device before closing it */
+int hid_reactor_remove( struct hid_reactor * reactor, hid_device * device );
+
+/** waits until at least one device is ready, for milliseconds or -1 to block, then calls the
+ *  callbacks of the ready devices. When ready is not NULL, at most max_ready devices are handled,
+ *  and they are stored in it. Without devices it only waits for the timeout or a wake. Returns
+ *  the number of ready devices, 0 on timeout, wake or interrupt, -1 on error */
+int hid_reactor_wait( struct hid_reactor * reactor, hid_device ** ready, int max_ready, int milliseconds );
+
+/** makes the current or the next hid_reactor_wait return 0; safe to call from another thread,
+ *  e.g. after changing a list of devices that the waiting thread adds to the reactor */
+void hid_reactor_wake( struct hid_reactor * reactor );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
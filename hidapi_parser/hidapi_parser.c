@@ -25,8 +25,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <stdint.h>
+#include <stddef.h>
 // #include <math.h>
 
+#if defined(__AVX2__) || defined(__BMI2__)
+	#include <immintrin.h>
+#elif defined(__SSSE3__)
+	#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <time.h>
+	#include <pthread.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
 #include "hidapi_parser.h"
 
 // SET IN CMAKE
@@ -112,6 +136,18 @@
 
 // HID Input/Output/Feature Item Data (attributes) from HID 1.11 6.2.2.5
 /// more like flags - for input, output, and feature
+#define HID_USAGE_PAGE_KEYBOARD 0x07
+#define HID_USAGE_PAGE_VENDOR 0xFF00 // 0xFF00 to 0xFFFF
+
+// fewest adjacent 1 bit fields that are decoded together as a bit run
+#define HID_MIN_BIT_RUN 8
+#define HID_KEYBOARD_ERROR_UNDEFINED 0x03 // 1 to 3: rollover and other errors instead of keys
+
+// what a report did to a usage set; only a decoded set is compared with its previous state
+#define HID_USAGE_SET_SKIPPED 0  // none of its fields was decoded (not subscribed, short report)
+#define HID_USAGE_SET_DECODED 1
+#define HID_USAGE_SET_ROLLOVER 2 // the keyboard could not tell which keys are down
+
 #define HID_ITEM_CONSTANT 0x1 // data(0), constant(1)
 #define HID_ITEM_VARIABLE 0x2 // array(0), variable(1)
 #define HID_ITEM_RELATIVE 0x4 // absolute(0), relative(1)
@@ -130,79 +166,800 @@
 
 #define BITMASK1(n) ((1ULL << (n)) - 1ULL)
 
+static struct hid_device_descriptor * hid_build_descriptor( char* descr_buf, int size );
+static int hid_compile_report_layouts( struct hid_device_descriptor * descriptor );
+static int hid_decode_report( unsigned char* buf, int size, struct hid_dev_desc * devdesc, struct hid_report_layout * layout, unsigned long long timestamp );
+
+
+// the float tables at map_offset, each map_stride long
+#define HID_MAP_LOGICAL_SCALE   0
+#define HID_MAP_LOGICAL_OFFSET  1
+#define HID_MAP_PHYSICAL_SCALE  2
+#define HID_MAP_PHYSICAL_OFFSET 3
+
+#define HID_DESCRIPTOR_TABLE(descriptor, type, offset) ((type *) ((char *) (descriptor) + (descriptor)->offset))
+
+// the element values are published to other threads with a sequence lock: the decoding thread
+// makes the sequence odd while it writes the values of a report, readers copy the values and
+// retry when the sequence was odd or changed meanwhile
+#if defined(_MSC_VER)
+// volatile accesses are not reordered by msvc (/volatile:ms), the barrier keeps the compiler from it
+#define HID_LOAD_RELAXED(p) ( *(volatile int *) (p) )
+#define HID_STORE_RELAXED(p, v) ( *(volatile int *) (p) = (v) )
+#define HID_FENCE_ACQUIRE() _ReadWriteBarrier()
+#define HID_FENCE_RELEASE() _ReadWriteBarrier()
+#else
+#define HID_LOAD_RELAXED(p) __atomic_load_n( (p), __ATOMIC_RELAXED )
+#define HID_STORE_RELAXED(p, v) __atomic_store_n( (p), (v), __ATOMIC_RELAXED )
+#define HID_FENCE_ACQUIRE() __atomic_thread_fence( __ATOMIC_ACQUIRE )
+#define HID_FENCE_RELEASE() __atomic_thread_fence( __ATOMIC_RELEASE )
+#endif
+
+static inline void hid_values_write_begin( struct hid_dev_desc * devdesc ){
+  HID_STORE_RELAXED( &devdesc->values_sequence, devdesc->values_sequence + 1 );
+  HID_FENCE_RELEASE();
+}
+
+static inline void hid_values_write_end( struct hid_dev_desc * devdesc ){
+  HID_FENCE_RELEASE();
+  HID_STORE_RELAXED( &devdesc->values_sequence, devdesc->values_sequence + 1 );
+}
+
+// only the decoding thread writes values, readers on other threads take snapshots
+static inline void hid_store_value( struct hid_dev_desc * devdesc, int index, int value ){
+  HID_STORE_RELAXED( &devdesc->values[ index ], value );
+}
+
+static int hid_align( int size ){
+  return ( size + 7 ) & ~7;
+}
+
+// the whole parsed descriptor lives in one block: header, elements, collections,
+// report ids and lengths, compiled layouts, fields and the report id dispatch table
+static struct hid_device_descriptor * hid_new_descriptor( int num_elements, int num_collections, int num_reports, int raw_size ){
+  struct hid_device_descriptor * descriptor;
+  int size = hid_align( sizeof( struct hid_device_descriptor ) );
+  int raw_offset = size;
+  size += hid_align( raw_size );
+  int elements_offset = size;
+  size += hid_align( sizeof( struct hid_device_element ) * num_elements );
+  int collections_offset = size;
+  size += hid_align( sizeof( struct hid_device_collection ) * num_collections );
+  int report_ids_offset = size;
+  size += hid_align( sizeof( int ) * num_reports );
+  int report_lengths_offset = size;
+  size += hid_align( sizeof( int ) * num_reports );
+  int layouts_offset = size;
+  size += hid_align( sizeof( struct hid_report_layout ) * 3 * num_reports );
+  int fields_offset = size;
+  size += hid_align( sizeof( struct hid_report_field ) * num_elements );
+  int dispatch_offset = size;
+  size += hid_align( sizeof( short ) * 3 * HID_REPORT_DISPATCH_SIZE );
+  int map_stride = ( num_elements + 7 ) & ~7;
+  int map_offset = size;
+  size += hid_align( sizeof( float ) * 4 * map_stride );
+  int value_index_offset = size;
+  size += hid_align( sizeof( int ) * num_elements );
+  int usage_sets_offset = size;
+  size += hid_align( sizeof( struct hid_usage_set ) * num_elements );
+  int element_keys_size = 8;
+  while ( element_keys_size < 2 * num_elements ){
+    element_keys_size *= 2;
+  }
+  int element_keys_offset = size;
+  size += hid_align( sizeof( struct hid_element_key ) * element_keys_size );
+  int io_elements_offset = size;
+  size += hid_align( sizeof( int ) * num_elements );
+  int bit_runs_offset = size;
+  size += hid_align( sizeof( struct hid_bit_run ) * ( num_elements / HID_MIN_BIT_RUN + 1 ) );
+
+  descriptor = (struct hid_device_descriptor *) calloc( 1, size );
+  if ( descriptor == NULL ){
+    return NULL;
+  }
+  descriptor->size = size;
+  descriptor->raw_offset = raw_offset;
+  descriptor->raw_size = raw_size;
+  descriptor->elements_offset = elements_offset;
+  descriptor->collections_offset = collections_offset;
+  descriptor->report_ids_offset = report_ids_offset;
+  descriptor->report_lengths_offset = report_lengths_offset;
+  descriptor->layouts_offset = layouts_offset;
+  descriptor->fields_offset = fields_offset;
+  descriptor->dispatch_offset = dispatch_offset;
+  descriptor->map_stride = map_stride;
+  descriptor->map_offset = map_offset;
+  descriptor->value_index_offset = value_index_offset;
+  descriptor->usage_sets_offset = usage_sets_offset;
+  descriptor->element_keys_offset = element_keys_offset;
+  descriptor->element_keys_size = element_keys_size;
+  descriptor->io_elements_offset = io_elements_offset;
+  descriptor->bit_runs_offset = bit_runs_offset;
+  return descriptor;
+}
+
+static void hid_free_descriptor( struct hid_device_descriptor * descriptor ){
+  free( descriptor );
+}
+
+//// ---------- descriptor cache
+
+// identical devices share one parsed descriptor, looked up by the hash of the raw report descriptor
+
+struct hid_descriptor_cache_entry {
+  struct hid_device_descriptor * descriptor;
+  int refcount;
+  int mapped; // lives in the loaded cache file, is not freed
+  struct hid_descriptor_cache_entry * next;
+};
+
+static struct hid_descriptor_cache_entry * hid_descriptor_cache = NULL;
+
+#ifdef _WIN32
+static SRWLOCK hid_descriptor_cache_lock = SRWLOCK_INIT;
+#define HID_CACHE_LOCK() AcquireSRWLockExclusive( &hid_descriptor_cache_lock )
+#define HID_CACHE_UNLOCK() ReleaseSRWLockExclusive( &hid_descriptor_cache_lock )
+#else
+static pthread_mutex_t hid_descriptor_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define HID_CACHE_LOCK() pthread_mutex_lock( &hid_descriptor_cache_lock )
+#define HID_CACHE_UNLOCK() pthread_mutex_unlock( &hid_descriptor_cache_lock )
+#endif
+
+// FNV-1a
+unsigned int hid_descriptor_hash( const unsigned char * descr_buf, int size ){
+  unsigned int hash = 2166136261U;
+  int i;
+  for ( i = 0; i < size; i++ ){
+    hash ^= descr_buf[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static struct hid_device_descriptor * hid_acquire_descriptor( char * descr_buf, int size ){
+  struct hid_descriptor_cache_entry * entry;
+  struct hid_device_descriptor * descriptor = NULL;
+  unsigned int hash = hid_descriptor_hash( (const unsigned char *) descr_buf, size );
+
+  HID_CACHE_LOCK();
+  for ( entry = hid_descriptor_cache; entry != NULL; entry = entry->next ){
+    struct hid_device_descriptor * cached = entry->descriptor;
+    if ( cached->hash == hash && cached->raw_size == size &&
+	 memcmp( HID_DESCRIPTOR_TABLE( cached, char, raw_offset ), descr_buf, size ) == 0 ){
+      entry->refcount++;
+      descriptor = cached;
+      break;
+    }
+  }
+  if ( descriptor == NULL ){
+    descriptor = hid_build_descriptor( descr_buf, size );
+    entry = descriptor != NULL ? (struct hid_descriptor_cache_entry *) malloc( sizeof( struct hid_descriptor_cache_entry ) ) : NULL;
+    if ( entry == NULL ){
+      hid_free_descriptor( descriptor );
+      descriptor = NULL;
+    } else {
+      entry->descriptor = descriptor;
+      entry->refcount = 1;
+      entry->mapped = 0;
+      entry->next = hid_descriptor_cache;
+      hid_descriptor_cache = entry;
+    }
+  }
+  HID_CACHE_UNLOCK();
+  return descriptor;
+}
+
+static void hid_release_descriptor( struct hid_device_descriptor * descriptor ){
+  struct hid_descriptor_cache_entry ** link;
+
+  HID_CACHE_LOCK();
+  for ( link = &hid_descriptor_cache; *link != NULL; link = &(*link)->next ){
+    struct hid_descriptor_cache_entry * entry = *link;
+    if ( entry->descriptor == descriptor ){
+      entry->refcount--;
+      if ( entry->refcount == 0 && !entry->mapped ){
+	*link = entry->next;
+	hid_free_descriptor( descriptor );
+	free( entry );
+      }
+      break;
+    }
+  }
+  HID_CACHE_UNLOCK();
+}
+
+//// ---------- generated decoders
+
+#define HID_MAX_DECODERS 32
+
+struct hid_decoder_entry {
+  unsigned int hash;
+  int raw_size;
+  const unsigned char * raw; // the descriptor of the generated header, compared in full
+  hid_report_decoder decoder;
+};
+
+static struct hid_decoder_entry hid_decoders[ HID_MAX_DECODERS ];
+static int hid_number_of_decoders = 0;
+
+int hid_register_decoder( const unsigned char * descriptor, int descriptor_size, hid_report_decoder decoder ){
+  unsigned int hash = hid_descriptor_hash( descriptor, descriptor_size );
+  int i;
+  int result = -1;
+  HID_CACHE_LOCK();
+  for ( i = 0; i < hid_number_of_decoders; i++ ){
+    if ( hid_decoders[i].hash == hash && hid_decoders[i].raw_size == descriptor_size &&
+	 memcmp( hid_decoders[i].raw, descriptor, descriptor_size ) == 0 ){
+      break; // replaces the earlier one
+    }
+  }
+  if ( i < HID_MAX_DECODERS ){
+    hid_decoders[i].hash = hash;
+    hid_decoders[i].raw_size = descriptor_size;
+    hid_decoders[i].raw = descriptor;
+    hid_decoders[i].decoder = decoder;
+    if ( i == hid_number_of_decoders ){
+      hid_number_of_decoders++;
+    }
+    result = 0;
+  }
+  HID_CACHE_UNLOCK();
+  return result;
+}
+
+static hid_report_decoder hid_find_decoder( const struct hid_device_descriptor * descriptor ){
+  const unsigned char * raw = (const unsigned char *) descriptor + descriptor->raw_offset;
+  hid_report_decoder decoder = NULL;
+  int i;
+  HID_CACHE_LOCK();
+  for ( i = 0; i < hid_number_of_decoders; i++ ){
+    // the hash only picks the candidates, a decoder for another layout must never be used
+    if ( hid_decoders[i].hash == descriptor->hash && hid_decoders[i].raw_size == descriptor->raw_size &&
+	 memcmp( hid_decoders[i].raw, raw, descriptor->raw_size ) == 0 ){
+      decoder = hid_decoders[i].decoder;
+      break;
+    }
+  }
+  HID_CACHE_UNLOCK();
+  return decoder;
+}
+
+//// ---------- descriptor cache file
+
+// the descriptor blocks contain no pointers, so a cache file is just a header followed by
+// the blocks as they are in memory; it is mapped read-only and the blocks are used in place
+
+#define HID_CACHE_FILE_MAGIC   0x43444948 // "HIDC", also tells the byte order
+#define HID_CACHE_FILE_VERSION 8
+
+struct hid_cache_file_header {
+  int magic;
+  int version;
+  /** sizes of the stored structs, a file from a build with other structs is not used */
+  int descriptor_size;
+  int element_size;
+  int collection_size;
+  int layout_size;
+  int field_size;
+  int usage_set_size;
+  int bit_run_size;
+  int num_descriptors;
+  int size; // of the whole file
+};
+
+static void * hid_cache_file_data = NULL;
+static int hid_cache_file_size = 0;
+
+static int hid_check_table( const struct hid_device_descriptor * descriptor, int offset, int count, int item_size ){
+  return offset >= (int) sizeof( struct hid_device_descriptor ) && ( offset & 7 ) == 0 && count >= 0 &&
+	 (long long) offset + (long long) count * item_size <= descriptor->size;
+}
+
+// index into a table of count entries, or -1 for none when that is allowed
+static int hid_check_index( int index, int count, int none ){
+  return ( index >= 0 && index < count ) || ( none && index == -1 );
+}
+
+// a link to a later entry of the table, or -1; walking the links always ends
+static int hid_check_link( int link, int from, int count ){
+  return link == -1 || ( link > from && link < count );
+}
+
+// check the indices stored in the tables of a block read from a file, against the table counts
+static int hid_check_indices( const struct hid_device_descriptor * descriptor ){
+  const struct hid_device_element * elements = HID_DESCRIPTOR_TABLE( descriptor, struct hid_device_element, elements_offset );
+  const struct hid_device_collection * collections = HID_DESCRIPTOR_TABLE( descriptor, struct hid_device_collection, collections_offset );
+  const struct hid_report_layout * layouts = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_layout, layouts_offset );
+  const struct hid_report_field * fields = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_field, fields_offset );
+  const short * report_dispatch = HID_DESCRIPTOR_TABLE( descriptor, short, dispatch_offset );
+  const int * value_index = HID_DESCRIPTOR_TABLE( descriptor, int, value_index_offset );
+  const struct hid_usage_set * usage_sets = HID_DESCRIPTOR_TABLE( descriptor, struct hid_usage_set, usage_sets_offset );
+  const struct hid_element_key * keys = HID_DESCRIPTOR_TABLE( descriptor, struct hid_element_key, element_keys_offset );
+  const int * io_elements = HID_DESCRIPTOR_TABLE( descriptor, int, io_elements_offset );
+  const struct hid_bit_run * bit_runs = HID_DESCRIPTOR_TABLE( descriptor, struct hid_bit_run, bit_runs_offset );
+  int num_elements = descriptor->num_elements;
+  int num_fields = descriptor->number_of_fields;
+  int i, j, io;
+
+  // the per device state is sized from these
+  if ( descriptor->report_buffer_size < 0 || descriptor->output_buffer_size < 0 || descriptor->max_usage_set_words < 0 ||
+       descriptor->usage_state_words < 0 || descriptor->usage_state_words > (long long) descriptor->number_of_usage_sets * descriptor->max_usage_set_words ||
+       descriptor->bit_state_words < 0 || descriptor->bit_state_words > num_fields ){
+    return 0;
+  }
+  for ( i = 0; i < num_elements; i++ ){
+    const struct hid_device_element * element = &elements[i];
+    if ( element->index != i || element->io_type < 1 || element->io_type > 3 || element->buffer_size < 0 ||
+	 !hid_check_index( element->field_index, num_fields, 1 ) ||
+	 !hid_check_index( element->parent_collection, descriptor->num_collections, 0 ) ||
+	 !hid_check_link( element->next, i, num_elements ) || !hid_check_link( element->next_of_type, i, num_elements ) ){
+      return 0;
+    }
+  }
+  for ( i = 0; i < descriptor->num_collections; i++ ){
+    const struct hid_device_collection * collection = &collections[i];
+    if ( collection->index != i || !hid_check_index( collection->parent_collection, i, i == 0 ) ||
+	 !hid_check_link( collection->next_collection, i, descriptor->num_collections ) ||
+	 !hid_check_link( collection->first_collection, i, descriptor->num_collections ) ||
+	 !hid_check_index( collection->first_element, num_elements, 1 ) ){
+      return 0;
+    }
+  }
+  for ( i = 0; i < 3 * HID_REPORT_DISPATCH_SIZE; i++ ){
+    if ( !hid_check_index( report_dispatch[i], descriptor->number_of_layouts, 1 ) ||
+	 ( report_dispatch[i] != -1 && layouts[ report_dispatch[i] ].io_type != i / HID_REPORT_DISPATCH_SIZE + 1 ) ){
+      return 0;
+    }
+  }
+  for ( i = 0; i < descriptor->number_of_layouts; i++ ){
+    const struct hid_report_layout * layout = &layouts[i];
+    int report_bytes = ( layout->report_bits + 7 ) / 8;
+    if ( layout->io_type < 1 || layout->io_type > 3 || layout->report_bits < 0 ||
+	 layout->first_field < 0 || layout->num_fields < 0 || layout->first_field > num_fields - layout->num_fields ||
+	 layout->report_offset < 0 || layout->report_offset > descriptor->report_buffer_size - report_bytes ||
+	 layout->first_usage_set < 0 || layout->num_usage_sets < 0 ||
+	 layout->first_usage_set > descriptor->number_of_usage_sets - layout->num_usage_sets ){
+      return 0;
+    }
+    if ( layout->io_type == 1 ? layout->output_offset != -1 :
+	 layout->output_offset < 0 || layout->output_offset > descriptor->output_buffer_size - 1 - report_bytes ){
+      return 0;
+    }
+    for ( j = layout->first_field; j < layout->first_field + layout->num_fields; j++ ){
+      const struct hid_report_field * field = &fields[j];
+      const struct hid_device_element * element;
+      if ( !hid_check_index( field->element_index, num_elements, 0 ) || field->bit_offset < 0 || field->bit_size < 1 ||
+	   field->bit_offset > layout->report_bits - field->bit_size || value_index[j] != field->element_index ||
+	   !hid_check_index( field->usage_set, descriptor->number_of_usage_sets, 1 ) ||
+	   !hid_check_index( field->bit_run, descriptor->number_of_bit_runs, 1 ) ){
+	return 0;
+      }
+      element = &elements[ field->element_index ];
+      if ( element->field_index != j || element->io_type != layout->io_type ||
+	   ( element->buffer_size == 0 && field->bit_size > 32 ) ||
+	   ( element->buffer_size > 0 && field->bit_size != 8 * element->buffer_size ) ||
+	   ( element->buffer_offset >= 0 && element->buffer_offset > report_bytes - element->buffer_size ) ){
+	return 0;
+      }
+      if ( field->bit_run != -1 ){
+	const struct hid_bit_run * run = &bit_runs[ field->bit_run ];
+	if ( run->first_field != j || run->num_bits < 1 || run->num_bits > layout->first_field + layout->num_fields - j ||
+	     run->bit_offset != field->bit_offset || run->bit_offset > layout->report_bits - run->num_bits ){
+	  return 0;
+	}
+      }
+    }
+  }
+  for ( i = 0; i < descriptor->number_of_usage_sets; i++ ){
+    const struct hid_usage_set * set = &usage_sets[i];
+    if ( set->index != i || set->io_type < 1 || set->io_type > 3 || set->usage_min < 0 || set->usage_max < set->usage_min ||
+	 set->num_words < ( set->usage_max - set->usage_min ) / 64 + 1 || set->num_words > descriptor->max_usage_set_words ||
+	 set->state_offset < 0 || set->state_offset > descriptor->usage_state_words - set->num_words ){
+      return 0;
+    }
+  }
+  for ( i = 0; i < descriptor->number_of_bit_runs; i++ ){
+    const struct hid_bit_run * run = &bit_runs[i];
+    if ( run->index != i || !hid_check_index( run->first_field, num_fields, 0 ) || fields[ run->first_field ].bit_run != i ||
+	 run->state_offset < 0 || run->state_offset > descriptor->bit_state_words - ( run->num_bits + 63 ) / 64 ){
+      return 0;
+    }
+  }
+  for ( i = 0; i < descriptor->element_keys_size; i++ ){
+    if ( !hid_check_index( keys[i].element_index, num_elements, 1 ) ){
+      return 0;
+    }
+  }
+  for ( io = 0; io < 3; io++ ){
+    if ( descriptor->io_first[io] < 0 || descriptor->io_count[io] < 0 ||
+	 descriptor->io_first[io] > num_elements - descriptor->io_count[io] ){
+      return 0;
+    }
+    for ( i = descriptor->io_first[io]; i < descriptor->io_first[io] + descriptor->io_count[io]; i++ ){
+      if ( !hid_check_index( io_elements[i], num_elements, 0 ) || elements[ io_elements[i] ].io_type != io + 1 ){
+	return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// check that a block read from a file is consistent before handing it out
+static int hid_check_descriptor( const struct hid_device_descriptor * descriptor, int available ){
+  if ( available < (int) sizeof( struct hid_device_descriptor ) || descriptor->size > available ||
+       descriptor->size < (int) sizeof( struct hid_device_descriptor ) || ( descriptor->size & 7 ) != 0 ){
+    return 0;
+  }
+  if ( descriptor->num_collections < 1 || descriptor->number_of_reports < 1 ){
+    return 0;
+  }
+  return hid_check_table( descriptor, descriptor->raw_offset, descriptor->raw_size, 1 ) &&
+	 hid_check_table( descriptor, descriptor->elements_offset, descriptor->num_elements, sizeof( struct hid_device_element ) ) &&
+	 hid_check_table( descriptor, descriptor->collections_offset, descriptor->num_collections, sizeof( struct hid_device_collection ) ) &&
+	 hid_check_table( descriptor, descriptor->report_ids_offset, descriptor->number_of_reports, sizeof( int ) ) &&
+	 hid_check_table( descriptor, descriptor->report_lengths_offset, descriptor->number_of_reports, sizeof( int ) ) &&
+	 hid_check_table( descriptor, descriptor->layouts_offset, descriptor->number_of_layouts, sizeof( struct hid_report_layout ) ) &&
+	 hid_check_table( descriptor, descriptor->fields_offset, descriptor->number_of_fields, sizeof( struct hid_report_field ) ) &&
+	 hid_check_table( descriptor, descriptor->dispatch_offset, 3 * HID_REPORT_DISPATCH_SIZE, sizeof( short ) ) &&
+	 descriptor->map_stride >= descriptor->number_of_fields &&
+	 hid_check_table( descriptor, descriptor->map_offset, 4 * descriptor->map_stride, sizeof( float ) ) &&
+	 hid_check_table( descriptor, descriptor->value_index_offset, descriptor->number_of_fields, sizeof( int ) ) &&
+	 hid_check_table( descriptor, descriptor->usage_sets_offset, descriptor->number_of_usage_sets, sizeof( struct hid_usage_set ) ) &&
+	 descriptor->element_keys_size > 0 && ( descriptor->element_keys_size & ( descriptor->element_keys_size - 1 ) ) == 0 &&
+	 hid_check_table( descriptor, descriptor->element_keys_offset, descriptor->element_keys_size, sizeof( struct hid_element_key ) ) &&
+	 hid_check_table( descriptor, descriptor->io_elements_offset, descriptor->num_elements, sizeof( int ) ) &&
+	 hid_check_table( descriptor, descriptor->bit_runs_offset, descriptor->number_of_bit_runs, sizeof( struct hid_bit_run ) ) &&
+	 hid_check_indices( descriptor ) &&
+	 descriptor->hash == hid_descriptor_hash( (const unsigned char *) descriptor + descriptor->raw_offset, descriptor->raw_size );
+}
+
+static void hid_init_cache_file_header( struct hid_cache_file_header * header ){
+  memset( header, 0, sizeof( struct hid_cache_file_header ) );
+  header->magic = HID_CACHE_FILE_MAGIC;
+  header->version = HID_CACHE_FILE_VERSION;
+  header->descriptor_size = sizeof( struct hid_device_descriptor );
+  header->element_size = sizeof( struct hid_device_element );
+  header->collection_size = sizeof( struct hid_device_collection );
+  header->layout_size = sizeof( struct hid_report_layout );
+  header->field_size = sizeof( struct hid_report_field );
+  header->usage_set_size = sizeof( struct hid_usage_set );
+  header->bit_run_size = sizeof( struct hid_bit_run );
+}
+
+static void * hid_map_cache_file( const char * path, int * size ){
+  void * data;
+#ifdef _WIN32
+  FILE * file = fopen( path, "rb" );
+  long length;
+  if ( file == NULL ){
+    return NULL;
+  }
+  fseek( file, 0, SEEK_END );
+  length = ftell( file );
+  fseek( file, 0, SEEK_SET );
+  data = length > 0 ? malloc( length ) : NULL;
+  if ( data != NULL && fread( data, 1, length, file ) != (size_t) length ){
+    free( data );
+    data = NULL;
+  }
+  fclose( file );
+  *size = (int) length;
+#else
+  struct stat st;
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 ){
+    return NULL;
+  }
+  if ( fstat( fd, &st ) != 0 || st.st_size <= 0 || st.st_size > 0x7FFFFFFF ){
+    close( fd );
+    return NULL;
+  }
+  data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if ( data == MAP_FAILED ){
+    return NULL;
+  }
+  *size = (int) st.st_size;
+#endif
+  return data;
+}
+
+static void hid_unmap_cache_file( void * data, int size ){
+#ifdef _WIN32
+  free( data );
+#else
+  munmap( data, size );
+#endif
+}
+
+int hid_load_descriptor_cache( const char * path ){
+  struct hid_cache_file_header header;
+  struct hid_cache_file_header * stored;
+  int size = 0;
+  int offset;
+  int i;
+  char * data;
+
+  if ( hid_cache_file_data != NULL ){
+    return -1; // unload the current one first
+  }
+  data = (char *) hid_map_cache_file( path, &size );
+  if ( data == NULL ){
+    return -1;
+  }
+  stored = (struct hid_cache_file_header *) data;
+  hid_init_cache_file_header( &header );
+  if ( size < (int) sizeof( header ) || stored->magic != header.magic || stored->version != header.version ||
+       stored->descriptor_size != header.descriptor_size || stored->element_size != header.element_size ||
+       stored->collection_size != header.collection_size || stored->layout_size != header.layout_size ||
+       stored->field_size != header.field_size || stored->usage_set_size != header.usage_set_size ||
+       stored->bit_run_size != header.bit_run_size || stored->size != size ){
+    hid_unmap_cache_file( data, size );
+    return -1;
+  }
+
+  // check all blocks before adding any of them
+  offset = hid_align( sizeof( header ) );
+  for ( i = 0; i < stored->num_descriptors; i++ ){
+    struct hid_device_descriptor * descriptor = (struct hid_device_descriptor *) ( data + offset );
+    if ( offset > size || !hid_check_descriptor( descriptor, size - offset ) ){
+      hid_unmap_cache_file( data, size );
+      return -1;
+    }
+    offset += descriptor->size;
+  }
+
+  HID_CACHE_LOCK();
+  offset = hid_align( sizeof( header ) );
+  for ( i = 0; i < stored->num_descriptors; i++ ){
+    struct hid_device_descriptor * descriptor = (struct hid_device_descriptor *) ( data + offset );
+    struct hid_descriptor_cache_entry * entry = (struct hid_descriptor_cache_entry *) malloc( sizeof( struct hid_descriptor_cache_entry ) );
+    if ( entry == NULL ){
+      break;
+    }
+    entry->descriptor = descriptor;
+    entry->refcount = 0;
+    entry->mapped = 1;
+    entry->next = hid_descriptor_cache;
+    hid_descriptor_cache = entry;
+    offset += descriptor->size;
+  }
+  if ( i < stored->num_descriptors ){
+    // out of memory: take out the entries added so far, nothing can have used them yet
+    while ( i-- > 0 ){
+      struct hid_descriptor_cache_entry * entry = hid_descriptor_cache;
+      hid_descriptor_cache = entry->next;
+      free( entry );
+    }
+    HID_CACHE_UNLOCK();
+    hid_unmap_cache_file( data, size );
+    return -1;
+  }
+  hid_cache_file_data = data;
+  hid_cache_file_size = size;
+  HID_CACHE_UNLOCK();
+
+#ifdef DEBUG_PARSER
+  printf("loaded %i descriptors from %s\n", stored->num_descriptors, path );
+#endif
+  return stored->num_descriptors;
+}
+
+int hid_unload_descriptor_cache( void ){
+  struct hid_descriptor_cache_entry ** link;
+  struct hid_descriptor_cache_entry * entry;
+
+  HID_CACHE_LOCK();
+  for ( entry = hid_descriptor_cache; entry != NULL; entry = entry->next ){
+    if ( entry->mapped && entry->refcount > 0 ){
+      HID_CACHE_UNLOCK();
+      return -1; // still used by an open device
+    }
+  }
+  link = &hid_descriptor_cache;
+  while ( *link != NULL ){
+    entry = *link;
+    if ( entry->mapped ){
+      *link = entry->next;
+      free( entry );
+    } else {
+      link = &entry->next;
+    }
+  }
+  if ( hid_cache_file_data != NULL ){
+    hid_unmap_cache_file( hid_cache_file_data, hid_cache_file_size );
+    hid_cache_file_data = NULL;
+    hid_cache_file_size = 0;
+  }
+  HID_CACHE_UNLOCK();
+  return 0;
+}
+
+int hid_save_descriptor_cache( const char * path ){
+  struct hid_cache_file_header header;
+  struct hid_descriptor_cache_entry * entry;
+  char tmppath[1024];
+  char padding[8];
+  FILE * file;
+  int ok = 1;
+
+  if ( snprintf( tmppath, sizeof( tmppath ), "%s.tmp", path ) >= (int) sizeof( tmppath ) ){
+    return -1;
+  }
+  file = fopen( tmppath, "wb" );
+  if ( file == NULL ){
+    return -1;
+  }
+  memset( padding, 0, sizeof( padding ) );
+  hid_init_cache_file_header( &header );
+  header.size = hid_align( sizeof( header ) );
+
+  HID_CACHE_LOCK();
+  for ( entry = hid_descriptor_cache; entry != NULL; entry = entry->next ){
+    header.num_descriptors++;
+    header.size += entry->descriptor->size;
+  }
+  ok = fwrite( &header, sizeof( header ), 1, file ) == 1 &&
+       fwrite( padding, hid_align( sizeof( header ) ) - sizeof( header ), 1, file ) <= 1;
+  for ( entry = hid_descriptor_cache; ok && entry != NULL; entry = entry->next ){
+    ok = fwrite( entry->descriptor, entry->descriptor->size, 1, file ) == 1;
+  }
+  HID_CACHE_UNLOCK();
+
+  if ( fclose( file ) != 0 ){
+    ok = 0;
+  }
+  if ( !ok ){
+    remove( tmppath );
+    return -1;
+  }
+  // replace the old file in one step, a mapped old file stays valid
+#ifdef _WIN32
+  remove( path );
+#endif
+  if ( rename( tmppath, path ) != 0 ){
+    remove( tmppath );
+    return -1;
+  }
+  return header.num_descriptors;
+}
+
+// first pass over the report descriptor: count what the parser will create
+static void hid_count_descriptor( char* descr_buf, int size, int * num_elements, int * num_collections, int * num_reports ){
+  int next_byte_tag = -1;
+  int next_byte_size = 0;
+  int next_val = 0;
+  int byte_count = 0;
+  int report_count = 0;
+  unsigned char seen_ids[256];
+  int i;
+
+  memset( seen_ids, 0, sizeof( seen_ids ) );
+  seen_ids[0] = 1;
+  *num_elements = 0;
+  *num_collections = 1; // the device collection
+  *num_reports = 1;
+  for ( i = 0; i < size; i++ ){
+    if ( next_byte_tag != -1 ){
+      next_val |= (int)(((unsigned char)(descr_buf[i])) << (byte_count*8));
+      byte_count++;
+      if ( byte_count == next_byte_size ){
+	switch( next_byte_tag ){
+	  case HID_COLLECTION:
+	    (*num_collections)++;
+	    break;
+	  case HID_REPORT_COUNT:
+	    report_count = next_val;
+	    break;
+	  case HID_REPORT_ID:
+	    if ( !seen_ids[ next_val & 0xFF ] ){
+	      seen_ids[ next_val & 0xFF ] = 1;
+	      (*num_reports)++;
+	    }
+	    break;
+	  case HID_INPUT:
+	  case HID_OUTPUT:
+	  case HID_FEATURE:
+	    if ( report_count > 0 ){
+	      *num_elements += report_count;
+	    }
+	    break;
+	}
+	next_byte_tag = -1;
+      }
+    } else if ( descr_buf[i] != (char)HID_END_COLLECTION ){
+      byte_count = 0;
+      next_val = 0;
+      next_byte_tag = descr_buf[i] & 0xFC;
+      next_byte_size = descr_buf[i] & 0x03;
+      if ( next_byte_size == 3 ){
+	next_byte_size = 4;
+      }
+    }
+  }
+}
 
-// struct hid_device_descriptor * hid_new_descriptor(){
-//   struct hid_device_descriptor * descriptor;
-//   descriptor = (struct hid_device_descriptor *) malloc( sizeof( struct hid_device_descriptor) );
-// //     hid_descriptor_init( descriptor );
-// 
-//   descriptor->first = NULL;
-//   hid_set_descriptor_callback(descriptor, NULL, NULL);
-//   hid_set_element_callback(descriptor, NULL, NULL);
-//   return descriptor;
-// }
-
-struct hid_device_element * hid_new_element(){
-  struct hid_device_element * element = (struct hid_device_element *) malloc( sizeof( struct hid_device_element ) );
-  element->next = NULL;
-  element->report_id = 0;
-  return element;
-}
-
-void hid_free_element( struct hid_device_element * ele ){
-  free( ele );
-}
-
-struct hid_device_collection * hid_new_collection(){
-  struct hid_device_collection * collection = (struct hid_device_collection *) malloc( sizeof( struct hid_device_collection ) );
-  collection->first_collection = NULL;
-  collection->next_collection = NULL;
-  collection->parent_collection = NULL;
-  collection->first_element = NULL;
-  collection->num_collections = 0;
-  collection->num_elements = 0;
-  collection->index = -1;
-  collection->usage_page = 0;
-  collection->usage_index = 0;
-  return collection;
-}
-
-void hid_free_collection( struct hid_device_collection * coll ){
-  struct hid_device_element * cur_element = coll->first_element;
-  struct hid_device_element * next_element;
-  while (cur_element != NULL ) {
-    next_element = cur_element->next;
-    free( cur_element );
-    cur_element = next_element;
-  }
-  struct hid_device_collection * cur_collection = coll->first_collection;
-  struct hid_device_collection * next_collection;
-  while (cur_collection != NULL ) {
-    next_collection = cur_collection->next_collection;
-    free( cur_collection );
-    cur_collection = next_collection;
-  }
-  free( coll );
-}
-
-// void hid_descriptor_init( struct hid_device_descriptor * devd){
-//   devd->first = NULL;
-//   hid_set_descriptor_callback(devd, NULL, NULL);
-//   hid_set_element_callback(devd, NULL, NULL);
-// }
-
-// void hid_free_descriptor( struct hid_device_descriptor * devd){
-//   struct hid_device_element * cur_element = devd->first;
-//   struct hid_device_element * next_element;
-//   while (cur_element != NULL ) {
-//     next_element = cur_element->next;
-//     free( cur_element );
-//     cur_element = next_element;
-//   }
-//   free( devd );
-// //   hid_set_descriptor_callback(devd, NULL, NULL);
-// //   hid_set_element_callback(devd, NULL, NULL);
-// }
+// set up a device to use a parsed descriptor; the descriptor, with its elements, is shared
+// and only read, the element values and the change set are per device; returns -1 if the
+// per device state can not be allocated
+static int hid_attach_descriptor( struct hid_dev_desc * devdesc, struct hid_device_descriptor * descriptor ){
+  int values_size = hid_align( sizeof( int ) * descriptor->num_elements );
+  int changes_size = hid_align( sizeof( struct hid_element_change ) * ( descriptor->number_of_fields + 1 ) );
+  int output_size = hid_align( descriptor->output_buffer_size );
+  int usage_size = sizeof( unsigned long long ) * ( 2 * descriptor->usage_state_words + 2 * descriptor->max_usage_set_words );
+  int dirty_size = hid_align( descriptor->number_of_layouts + 1 );
+  int report_data_size = hid_align( sizeof( const unsigned char * ) * ( descriptor->number_of_layouts + 1 ) );
+  int bit_state_size = sizeof( unsigned long long ) * descriptor->bit_state_words;
+  int decoded_size = hid_align( sizeof( int ) * ( descriptor->number_of_fields + 1 ) );
+  int rollover_size = descriptor->number_of_usage_sets + 1;
+  char * state = (char *) calloc( values_size + changes_size + output_size + dirty_size + usage_size + report_data_size + bit_state_size + decoded_size + rollover_size, 1 );
+
+  if ( state == NULL ){
+    return -1;
+  }
+  devdesc->descriptor = descriptor;
+  devdesc->elements = HID_DESCRIPTOR_TABLE( descriptor, struct hid_device_element, elements_offset );
+  devdesc->values = (int *) state;
+  devdesc->values_sequence = 0;
+  devdesc->collections = HID_DESCRIPTOR_TABLE( descriptor, struct hid_device_collection, collections_offset );
+  devdesc->device_collection = &devdesc->collections[0];
+
+  devdesc->number_of_reports = descriptor->number_of_reports;
+  devdesc->report_ids = HID_DESCRIPTOR_TABLE( descriptor, int, report_ids_offset );
+  devdesc->report_lengths = HID_DESCRIPTOR_TABLE( descriptor, int, report_lengths_offset );
+
+  devdesc->number_of_layouts = descriptor->number_of_layouts;
+  devdesc->layouts = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_layout, layouts_offset );
+  devdesc->number_of_fields = descriptor->number_of_fields;
+  devdesc->fields = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_field, fields_offset );
+  devdesc->report_dispatch = HID_DESCRIPTOR_TABLE( descriptor, short, dispatch_offset );
+
+  // per device state
+  devdesc->report_buffer_size = descriptor->report_buffer_size;
+  devdesc->report_buffer = NULL;
+  devdesc->report_seen = NULL;
+  devdesc->changes_only = 0;
+  // room for the change set of the largest report
+  devdesc->changes = (struct hid_element_change *) ( state + values_size );
+  devdesc->_report_callback = NULL;
+  devdesc->_report_data = NULL;
+  devdesc->_element_callback = NULL;
+  devdesc->_element_data = NULL;
+  devdesc->_descriptor_callback = NULL;
+  devdesc->_descriptor_data = NULL;
+
+  // zeroed output reports with their report id in front, nothing dirty
+  devdesc->output_buffer_size = descriptor->output_buffer_size;
+  devdesc->output_buffer = (unsigned char *) ( state + values_size + changes_size );
+  devdesc->output_dirty = (unsigned char *) ( state + values_size + changes_size + output_size );
+  devdesc->num_dirty = 0;
+
+  devdesc->number_of_usage_sets = descriptor->number_of_usage_sets;
+  devdesc->usage_sets = HID_DESCRIPTOR_TABLE( descriptor, struct hid_usage_set, usage_sets_offset );
+  devdesc->usage_state = (unsigned long long *) ( state + values_size + changes_size + output_size + dirty_size );
+  devdesc->usage_next = devdesc->usage_state + descriptor->usage_state_words;
+  devdesc->usage_pressed = devdesc->usage_next + descriptor->usage_state_words;
+  devdesc->usage_released = devdesc->usage_pressed + descriptor->max_usage_set_words;
+  devdesc->usage_update = (unsigned char *) ( state + values_size + changes_size + output_size + dirty_size + usage_size + report_data_size + bit_state_size + decoded_size );
+  devdesc->report_data = (const unsigned char **) ( state + values_size + changes_size + output_size + dirty_size + usage_size );
+  devdesc->number_of_bit_runs = descriptor->number_of_bit_runs;
+  devdesc->bit_runs = HID_DESCRIPTOR_TABLE( descriptor, struct hid_bit_run, bit_runs_offset );
+  devdesc->bit_state = (unsigned long long *) ( state + values_size + changes_size + output_size + dirty_size + usage_size + report_data_size );
+  devdesc->_decoder = hid_find_decoder( descriptor );
+  devdesc->conditioning = NULL;
+  devdesc->decoded_values = (int *) ( state + values_size + changes_size + output_size + dirty_size + usage_size + report_data_size + bit_state_size );
+  devdesc->_usage_callback = NULL;
+  devdesc->_usage_data = NULL;
+  devdesc->subscribed_fields = NULL;
+  devdesc->subscribed_ranges = NULL;
+  int i;
+  for ( i = 0; i < devdesc->number_of_layouts; i++ ){
+    if ( devdesc->layouts[i].io_type != 1 ){
+      devdesc->output_buffer[ devdesc->layouts[i].output_offset ] = (unsigned char) devdesc->layouts[i].report_id;
+    }
+  }
+  return 0;
+}
 
 void hid_set_descriptor_callback( struct hid_dev_desc * devd, hid_descriptor_callback cb, void *user_data ){
     devd->_descriptor_callback = cb;
@@ -214,12 +971,132 @@ void hid_set_element_callback( struct hid_dev_desc * devd, hid_element_callback
     devd->_element_data = user_data;
 }
 
+void hid_set_report_callback( struct hid_dev_desc * devd, hid_report_callback cb, void *user_data ){
+    devd->_report_callback = cb;
+    devd->_report_data = user_data;
+}
+
+void hid_set_usage_callback( struct hid_dev_desc * devd, hid_usage_callback cb, void *user_data ){
+    devd->_usage_callback = cb;
+    devd->_usage_data = user_data;
+}
+
+static int hid_usage_subscribed( struct hid_dev_desc * devd, const struct hid_report_field * field, const struct hid_usage_id * usages, int num_usages ){
+  const struct hid_device_element * element = &devd->elements[ field->element_index ];
+  int i;
+  if ( element->type & HID_ITEM_CONSTANT ){
+    return 0; // padding
+  }
+  for ( i = 0; i < num_usages; i++ ){
+    if ( field->usage_set >= 0 ){
+      // an array field can report any usage of its set
+      const struct hid_usage_set * set = &devd->usage_sets[ field->usage_set ];
+      if ( usages[i].usage_page == set->usage_page && usages[i].usage >= set->usage_min && usages[i].usage <= set->usage_max ){
+	return 1;
+      }
+    } else if ( usages[i].usage_page == element->usage_page && usages[i].usage == element->usage ){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// only decode and report the fields of the given usages; no usages decodes everything again
+int hid_subscribe_usages( struct hid_dev_desc * devd, const struct hid_usage_id * usages, int num_usages ){
+  int num_fields = 0;
+  int i, j;
+
+  free( devd->subscribed_fields );
+  devd->subscribed_fields = NULL;
+  devd->subscribed_ranges = NULL;
+  if ( usages == NULL || num_usages <= 0 ){
+    return 0;
+  }
+
+  // fields and the range of each layout in one block
+  devd->subscribed_fields = (struct hid_report_field *) malloc( sizeof( struct hid_report_field ) * devd->number_of_fields + sizeof( int ) * 2 * devd->number_of_layouts );
+  if ( devd->subscribed_fields == NULL ){
+    return -1;
+  }
+  devd->subscribed_ranges = (int *) ( devd->subscribed_fields + devd->number_of_fields );
+  for ( i = 0; i < devd->number_of_layouts; i++ ){
+    const struct hid_report_layout * layout = &devd->layouts[i];
+    devd->subscribed_ranges[ 2*i ] = num_fields;
+    for ( j = layout->first_field; j < layout->first_field + layout->num_fields; j++ ){
+      if ( hid_usage_subscribed( devd, &devd->fields[j], usages, num_usages ) ){
+	devd->subscribed_fields[ num_fields ] = devd->fields[j];
+	devd->subscribed_fields[ num_fields ].bit_run = -1; // the run may be partly subscribed
+	num_fields++;
+      }
+    }
+    devd->subscribed_ranges[ 2*i + 1 ] = num_fields - devd->subscribed_ranges[ 2*i ];
+  }
+  return num_fields;
+}
+
+int hid_set_changes_only( struct hid_dev_desc * devd, int changes_only ){
+    if ( changes_only && devd->report_buffer == NULL ){
+      devd->report_buffer = (unsigned char *) calloc( devd->report_buffer_size + 1 + devd->number_of_layouts, 1 );
+      if ( devd->report_buffer == NULL ){
+	return -1;
+      }
+      devd->report_seen = devd->report_buffer + devd->report_buffer_size + 1;
+    }
+    if ( changes_only && !devd->changes_only ){
+      // the copies are from before, the next report of each layout is always decoded
+      memset( devd->report_seen, 0, devd->number_of_layouts );
+    }
+    devd->changes_only = changes_only;
+    return 0;
+}
+
 // int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_device_descriptor * descriptor ){
 int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc * device_desc ){
-  struct hid_device_collection * device_collection = hid_new_collection();
-  device_desc->device_collection = device_collection;
-  
-  struct hid_device_collection * parent_collection = device_desc->device_collection;
+  struct hid_device_descriptor * descriptor = hid_acquire_descriptor( descr_buf, size );
+  if ( descriptor == NULL ){
+    return -1;
+  }
+  if ( hid_attach_descriptor( device_desc, descriptor ) != 0 ){
+    hid_release_descriptor( descriptor );
+    return -1;
+  }
+  return 0;
+}
+
+// a vendor defined item of several bytes with one usage is kept as one buffer element
+// of that many bytes, instead of an element per byte
+static int hid_vendor_run_size( int usage_page, int usage_min, int usage_max, int num_usages, int report_size, int report_count, int flags ){
+  if ( usage_page < HID_USAGE_PAGE_VENDOR || report_size != 8 || report_count < 2 || ( flags & HID_ITEM_CONSTANT ) ){
+    return 0;
+  }
+  if ( usage_min != -1 ? ( usage_min != usage_max ) : ( num_usages > 1 ) ){
+    return 0; // several usages, these are separate values
+  }
+  return report_count;
+}
+
+static struct hid_device_descriptor * hid_build_descriptor( char* descr_buf, int size ){
+  int max_elements;
+  int max_collections;
+  int max_reports;
+  hid_count_descriptor( descr_buf, size, &max_elements, &max_collections, &max_reports );
+
+  struct hid_device_descriptor * descriptor = hid_new_descriptor( max_elements, max_collections, max_reports, size );
+  if ( descriptor == NULL ){
+    return NULL;
+  }
+  descriptor->hash = hid_descriptor_hash( (const unsigned char *) descr_buf, size );
+  memcpy( HID_DESCRIPTOR_TABLE( descriptor, char, raw_offset ), descr_buf, size );
+  struct hid_device_element * elements = HID_DESCRIPTOR_TABLE( descriptor, struct hid_device_element, elements_offset );
+  struct hid_device_collection * collections = HID_DESCRIPTOR_TABLE( descriptor, struct hid_device_collection, collections_offset );
+  struct hid_device_collection * device_collection = &collections[0];
+  device_collection->index = 0;
+  device_collection->parent_collection = -1;
+  device_collection->next_collection = -1;
+  device_collection->first_collection = -1;
+  device_collection->first_element = -1;
+
+  struct hid_device_collection * parent_collection = device_collection;
   struct hid_device_collection * prev_collection;
   struct hid_device_element * prev_element;
   int current_usage_page;
@@ -232,9 +1109,12 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
   int current_logical_max = 0;
   int current_physical_min = 0;
   int current_physical_max = 0;
-  int current_report_count;
+  int current_report_count = 0;
   int current_report_id = 0;
-  int current_report_size;
+  int current_report_size = 0;
+  int run_bytes; // vendor byte run of the current main item
+  int element_count;
+  int element_size;
   int current_unit = 0;
   int current_unit_exponent = 0;
   char current_input;
@@ -276,6 +1156,11 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 #endif
 	      byte_count++;
 	      if ( byte_count == next_byte_size ){
+		// signed interpretation of the item data, for the logical and physical extents
+		int next_sval = next_val;
+		if ( next_byte_size < 4 && ( next_val & (1 << (next_byte_size*8 - 1)) ) ){
+		  next_sval = next_val - (1 << (next_byte_size*8));
+		}
 		switch( next_byte_tag ){
 		  case HID_USAGE_PAGE:
 		    current_usage_page = next_val;
@@ -287,29 +1172,37 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 		    current_usage = next_val;
 		    current_usage_min = -1;
 		    current_usage_max = -1;
-		    current_usages[ current_usage_index ] = next_val;
+		    if ( current_usage_index < 256 ){
+		      current_usages[ current_usage_index ] = next_val;
 #ifdef DEBUG_PARSER
-		    printf("\n\tusage: 0x%02hhx, %i", current_usages[ current_usage_index ], current_usage_index );
+		      printf("\n\tusage: 0x%02hhx, %i", current_usages[ current_usage_index ], current_usage_index );
 #endif
-		    current_usage_index++;
+		      current_usage_index++;
+		    }
 		    break;
 		  case HID_COLLECTION:
 		  {
 		    //TODO: COULD ALSO READ WHICH KIND OF COLLECTION
-		    struct hid_device_collection * new_collection = hid_new_collection();
+		    if ( device_collection->num_collections + 1 >= max_collections ){
+		      break;
+		    }
+		    struct hid_device_collection * new_collection = &collections[ device_collection->num_collections + 1 ];
+		    new_collection->index = device_collection->num_collections + 1;
+		    new_collection->first_collection = -1;
+		    new_collection->next_collection = -1;
+		    new_collection->first_element = -1;
 		    if ( parent_collection->num_collections == 0 ){
-		      parent_collection->first_collection = new_collection;
+		      parent_collection->first_collection = new_collection->index;
 		    }
 		    if ( device_collection->num_collections == 0 ){
-		      device_collection->first_collection = new_collection;
+		      device_collection->first_collection = new_collection->index;
 		    } else {
-		      prev_collection->next_collection = new_collection;
+		      prev_collection->next_collection = new_collection->index;
 		    }
-		    new_collection->parent_collection = parent_collection;
+		    new_collection->parent_collection = parent_collection->index;
 		    new_collection->type = next_val;
 		    new_collection->usage_page = current_usage_page;
 		    new_collection->usage_index = current_usage;
-		    new_collection->index = device_collection->num_collections;
 		    device_collection->num_collections++;
 		    if ( device_collection != parent_collection ){
 		      parent_collection->num_collections++;
@@ -317,6 +1210,7 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 		    parent_collection = new_collection;
 		    prev_collection = new_collection;
 		    collection_nesting++;
+		    current_usage_index = 0; // the collection used up the usages so far
 #ifdef DEBUG_PARSER
 		    printf("\n\tcollection: %i, %i", collection_nesting, next_val );
 #endif
@@ -335,25 +1229,26 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 #endif
 		    break;
 		  case HID_LOGICAL_MIN:
-		    current_logical_min = next_val;
+		    current_logical_min = next_sval;
 #ifdef DEBUG_PARSER
 		    printf("\n\tlogical min: %i", current_logical_min);
 #endif
 		    break;
 		  case HID_LOGICAL_MAX:
-		    current_logical_max = next_val;
+		    // only treat the maximum as signed if the minimum is negative, many devices encode 255 in a single byte
+		    current_logical_max = ( current_logical_min < 0 ) ? next_sval : next_val;
 #ifdef DEBUG_PARSER
 		    printf("\n\tlogical max: %i", current_logical_max);
 #endif
 		    break;
 		  case HID_PHYSICAL_MIN:
-		    current_physical_min = next_val;
+		    current_physical_min = next_sval;
 #ifdef DEBUG_PARSER
 		    printf("\n\tphysical min: %i", current_physical_min);
 #endif
 		    break;
 		  case HID_PHYSICAL_MAX:
-		    current_physical_max = next_val;
+		    current_physical_max = ( current_physical_min < 0 ) ? next_sval : next_val;
 #ifdef DEBUG_PARSER
 		    printf("\n\tphysical max: %i", current_physical_min);
 #endif
@@ -373,9 +1268,12 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 		  case HID_REPORT_ID:
 		    current_report_id = next_val;
 		    // check if report id already exists
-		    int reportexists = 0;
+		    int reportexists = ( numreports >= max_reports );
 		    for ( j = 0; j < numreports; j++ ){
-		      reportexists = (report_ids[j] == current_report_id);
+		      if ( report_ids[j] == current_report_id ){
+			reportexists = 1;
+			break;
+		      }
 		    }
 		    if ( !reportexists ){
 		      report_ids[ numreports ] = current_report_id;
@@ -416,18 +1314,25 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 		    printf("\tcurrent_usage_index: %i", current_usage_index);
 #endif
 		    // add the elements for this report
-		    for ( j=0; j<current_report_count; j++ ){
-			struct hid_device_element * new_element = hid_new_element();
-// 			= (struct hid_device_element *) malloc( sizeof( struct hid_device_element ) );
+		    run_bytes = hid_vendor_run_size( current_usage_page, current_usage_min, current_usage_max, current_usage_index, current_report_size, current_report_count, next_val );
+		    element_count = run_bytes > 0 ? 1 : current_report_count;
+		    element_size = run_bytes > 0 ? 8 * run_bytes : current_report_size;
+		    for ( j=0; j<element_count; j++ ){
+			if ( device_collection->num_elements >= max_elements ){
+			  break;
+			}
+			struct hid_device_element * new_element = &elements[ device_collection->num_elements ];
+			new_element->next = -1;
 			new_element->index = device_collection->num_elements;
 			new_element->io_type = 1;
 			new_element->type = next_val; //TODO: parse this for more detailed info
-			new_element->parent_collection = parent_collection;
+			new_element->parent_collection = parent_collection->index;
 			new_element->usage_page = current_usage_page;
 			if ( current_usage_min != -1 ){
 			  new_element->usage = current_usage_min + j;
 			} else {
-			  new_element->usage = current_usages[j];
+			  // the last usage applies to the rest of the report count
+			  new_element->usage = current_usage_index == 0 ? 0 : current_usages[ j < current_usage_index ? j : current_usage_index - 1 ];
 			}
 			new_element->logical_min = current_logical_min;
 			new_element->logical_max = current_logical_max;
@@ -442,18 +1347,20 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 			new_element->unit = current_unit;
 			new_element->unit_exponent = current_unit_exponent;
 			
-			new_element->report_size = current_report_size;
+			new_element->report_size = element_size;
+			new_element->buffer_size = run_bytes;
 			new_element->report_id = current_report_id;
 			new_element->report_index = j;
+			new_element->usage_min = current_usage_min;
+			new_element->usage_max = current_usage_max;
 			
-			new_element->value = 0;
 			if ( parent_collection->num_elements == 0 ){
-			    parent_collection->first_element = new_element;
+			    parent_collection->first_element = new_element->index;
 			}
 			if ( device_collection->num_elements == 0 ){
-			    device_collection->first_element = new_element;
+			    device_collection->first_element = new_element->index;
 			} else {
-			    prev_element->next = new_element;
+			    prev_element->next = new_element->index;
 			}
 			device_collection->num_elements++;
 			if ( parent_collection != device_collection ) {
@@ -474,18 +1381,25 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 		    printf("\tcurrent_usage_index: %i", current_usage_index);
 #endif
 		    		    // add the elements for this report
-		    for ( j=0; j<current_report_count; j++ ){
-			struct hid_device_element * new_element = hid_new_element();
-// 			struct hid_device_element * new_element = (struct hid_device_element *) malloc( sizeof( struct hid_device_element ) );
+		    run_bytes = hid_vendor_run_size( current_usage_page, current_usage_min, current_usage_max, current_usage_index, current_report_size, current_report_count, next_val );
+		    element_count = run_bytes > 0 ? 1 : current_report_count;
+		    element_size = run_bytes > 0 ? 8 * run_bytes : current_report_size;
+		    for ( j=0; j<element_count; j++ ){
+			if ( device_collection->num_elements >= max_elements ){
+			  break;
+			}
+			struct hid_device_element * new_element = &elements[ device_collection->num_elements ];
+			new_element->next = -1;
 			new_element->index = device_collection->num_elements;
 			new_element->io_type = 2;
 			new_element->type = next_val; //TODO: parse this for more detailed info
-			new_element->parent_collection = parent_collection;
+			new_element->parent_collection = parent_collection->index;
 			new_element->usage_page = current_usage_page;
 			if ( current_usage_min != -1 ){
 			  new_element->usage = current_usage_min + j;
 			} else {
-			  new_element->usage = current_usages[j];
+			  // the last usage applies to the rest of the report count
+			  new_element->usage = current_usage_index == 0 ? 0 : current_usages[ j < current_usage_index ? j : current_usage_index - 1 ];
 			}
 			new_element->logical_min = current_logical_min;
 			new_element->logical_max = current_logical_max;
@@ -500,12 +1414,13 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 			new_element->unit = current_unit;
 			new_element->unit_exponent = current_unit_exponent;
 			
-			new_element->report_size = current_report_size;
+			new_element->report_size = element_size;
+			new_element->buffer_size = run_bytes;
 			new_element->report_id = current_report_id;
 			// check which id this is in the array, then add to report length
 			int k = 0;
 			int index = 0;
-			for ( k=0; i<numreports; k++ ){
+			for ( k=0; k<numreports; k++ ){
 			  if ( current_report_id == report_ids[k] ){
 			    index = k;
 			    break;
@@ -515,17 +1430,18 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 // 			    test = (k >= (numreports-1)) || (current_report_id != report_ids[k]);
 // 			    k++;
 // 			}
-			report_lengths[index] += current_report_size;
+			report_lengths[index] += element_size;
 			new_element->report_index = j;
+			new_element->usage_min = current_usage_min;
+			new_element->usage_max = current_usage_max;
 			
-			new_element->value = 0;
 			if ( parent_collection->num_elements == 0 ){
-			    parent_collection->first_element = new_element;
+			    parent_collection->first_element = new_element->index;
 			}
 			if ( device_collection->num_elements == 0 ){
-			    device_collection->first_element = new_element;
+			    device_collection->first_element = new_element->index;
 			} else {
-			    prev_element->next = new_element;
+			    prev_element->next = new_element->index;
 			}
 			device_collection->num_elements++;
 			if ( parent_collection != device_collection ) {
@@ -546,18 +1462,25 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 		    printf("\tcurrent_usage_index: %i", current_usage_index);
 #endif
 		    // add the elements for this report
-		    for ( j=0; j<current_report_count; j++ ){
-			struct hid_device_element * new_element = hid_new_element(); 
-// 			struct hid_device_element * new_element = (struct hid_device_element *) malloc( sizeof( struct hid_device_element ) );
+		    run_bytes = hid_vendor_run_size( current_usage_page, current_usage_min, current_usage_max, current_usage_index, current_report_size, current_report_count, next_val );
+		    element_count = run_bytes > 0 ? 1 : current_report_count;
+		    element_size = run_bytes > 0 ? 8 * run_bytes : current_report_size;
+		    for ( j=0; j<element_count; j++ ){
+			if ( device_collection->num_elements >= max_elements ){
+			  break;
+			}
+			struct hid_device_element * new_element = &elements[ device_collection->num_elements ];
+			new_element->next = -1;
 			new_element->index = device_collection->num_elements;
 			new_element->io_type = 3;
 			new_element->type = next_val; //TODO: parse this for more detailed info
-			new_element->parent_collection = parent_collection;
+			new_element->parent_collection = parent_collection->index;
 			new_element->usage_page = current_usage_page;
 			if ( current_usage_min != -1 ){
 			  new_element->usage = current_usage_min + j;
 			} else {
-			  new_element->usage = current_usages[j];
+			  // the last usage applies to the rest of the report count
+			  new_element->usage = current_usage_index == 0 ? 0 : current_usages[ j < current_usage_index ? j : current_usage_index - 1 ];
 			}
 			new_element->logical_min = current_logical_min;
 			new_element->logical_max = current_logical_max;
@@ -572,18 +1495,20 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 			new_element->unit = current_unit;
 			new_element->unit_exponent = current_unit_exponent;
 			
-			new_element->report_size = current_report_size;
+			new_element->report_size = element_size;
+			new_element->buffer_size = run_bytes;
 			new_element->report_id = current_report_id;
 			new_element->report_index = j;
+			new_element->usage_min = current_usage_min;
+			new_element->usage_max = current_usage_max;
 			
-			new_element->value = 0;
 			if ( parent_collection->num_elements == 0 ){
-			    parent_collection->first_element = new_element;
+			    parent_collection->first_element = new_element->index;
 			}
 			if ( device_collection->num_elements == 0 ){
-			    device_collection->first_element = new_element;
+			    device_collection->first_element = new_element->index;
 			} else {
-			    prev_element->next = new_element;
+			    prev_element->next = new_element->index;
 			}
 			device_collection->num_elements++;
 			if ( parent_collection != device_collection ) {
@@ -616,8 +1541,10 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
 	    if ( descr_buf[i] == (char)HID_END_COLLECTION ){ // JUST one byte
 // 	      prev_collection = parent_collection;
 	      current_usage_page = parent_collection->usage_page;
-	      current_usage_index = parent_collection->usage_index;
-	      parent_collection = parent_collection->parent_collection;
+	      current_usage_index = 0;
+	      if ( parent_collection->parent_collection >= 0 ){
+		parent_collection = &collections[ parent_collection->parent_collection ];
+	      }
 	      collection_nesting--;
 #ifdef DEBUG_PARSER
 	      printf("\n\tend collection: %i, %i\n", collection_nesting, descr_buf[i] );
@@ -641,310 +1568,1338 @@ int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc
   printf("----------- end parsing report descriptor --------------\n " );
 #endif
 
-  device_desc->number_of_reports = numreports;
-  device_desc->report_lengths = (int*) malloc( sizeof( int ) * numreports );
-  device_desc->report_ids = (int*) malloc( sizeof( int ) * numreports );
+  descriptor->num_elements = device_collection->num_elements;
+  descriptor->num_collections = device_collection->num_collections + 1;
+  descriptor->number_of_reports = numreports;
+  int * descriptor_report_lengths = HID_DESCRIPTOR_TABLE( descriptor, int, report_lengths_offset );
+  int * descriptor_report_ids = HID_DESCRIPTOR_TABLE( descriptor, int, report_ids_offset );
   for ( j = 0; j<numreports; j++ ){
-      device_desc->report_lengths[j] = report_lengths[j];
-      device_desc->report_ids[j] = report_ids[j];
+      descriptor_report_lengths[j] = report_lengths[j];
+      descriptor_report_ids[j] = report_ids[j];
   }
   
 #ifdef DEBUG_PARSER
   printf("----------- end setting report ids --------------\n " );
 #endif
-  
-  return 0;
-}
-
-float hid_element_map_logical( struct hid_device_element * element ){
-  float result = (float) element->logical_min + ( (float) element->value/( (float) element->logical_max - (float) element->logical_min ) );
-  return result;
-}
 
-/** TODO: implement */
-float hid_element_resolution( struct hid_device_element * element ){
-    float result = 0;
-//     ( element->logical_max - element->logical_min) / ( ( element->phys_max - element->phys_min) * pow(10, element->unit_exponent) );
-    return result;
-}
+  hid_compile_report_layouts( descriptor );
 
-/** TODO: implement */
-float hid_element_map_physical( struct hid_device_element * element ){
-  float result = 0;
-  return result;
+  return descriptor;
 }
 
-void hid_element_set_rawvalue( struct hid_device_element * element, int value ){
-  element->value = value;
-}
+// compile the elements into a flat table of bit fields per report id and io type,
+// so that reports can be decoded without walking the element list
+// value = raw * scale + offset, for the logical range mapped to 0..1 and for physical units
+static void hid_compute_element_map( struct hid_device_element * element ){
+  double logical_range = (double) element->logical_max - (double) element->logical_min;
+  double phys_min = element->phys_min;
+  double phys_max = element->phys_max;
+  double exponent = 1;
+  int unit_exponent = element->unit_exponent & 0x0F; // signed nibble
+  if ( unit_exponent > 7 ){
+    unit_exponent -= 16;
+  }
+  for ( ; unit_exponent > 0; unit_exponent-- ){ exponent *= 10; }
+  for ( ; unit_exponent < 0; unit_exponent++ ){ exponent /= 10; }
+  if ( phys_min == 0 && phys_max == 0 ){
+    // no physical extent given: the physical value is the logical value
+    phys_min = element->logical_min;
+    phys_max = element->logical_max;
+  }
 
-void hid_element_set_logicalvalue( struct hid_device_element * element, float value ){
-  int mapvalue;
-  mapvalue = (int) ( value * ( (float) element->logical_max - (float) element->logical_min ) ) - element->logical_min;
-  element->value = mapvalue;
+  element->logical_scale = 0;
+  element->logical_offset = 0;
+  element->physical_scale = 0;
+  element->physical_offset = (float) ( phys_min * exponent );
+  if ( logical_range != 0 ){
+    double scale = ( phys_max - phys_min ) / logical_range * exponent;
+    element->logical_scale = (float) ( 1.0 / logical_range );
+    element->logical_offset = (float) ( - (double) element->logical_min / logical_range );
+    element->physical_scale = (float) scale;
+    element->physical_offset = (float) ( phys_min * exponent - (double) element->logical_min * scale );
+  }
 }
 
-struct hid_device_element * hid_get_next_input_element( struct hid_device_element * curel ){
-
-  struct hid_device_element * nextel = curel->next;
-  while ( nextel != NULL ){
-      if ( nextel->io_type == 1 ){
-	  return nextel;
-      } else {
-	  nextel = nextel->next;
+// array fields hold usages, not states: group them per report and collection into sets of pressed usages
+static void hid_compile_usage_sets( struct hid_device_descriptor * descriptor ){
+  struct hid_device_element * elements = HID_DESCRIPTOR_TABLE( descriptor, struct hid_device_element, elements_offset );
+  struct hid_report_layout * layouts = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_layout, layouts_offset );
+  struct hid_report_field * fields = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_field, fields_offset );
+  struct hid_usage_set * usage_sets = HID_DESCRIPTOR_TABLE( descriptor, struct hid_usage_set, usage_sets_offset );
+  int num_sets = 0;
+  int i, j, k;
+
+  descriptor->usage_state_words = 0;
+  descriptor->max_usage_set_words = 0;
+  for ( i = 0; i < descriptor->number_of_layouts; i++ ){
+    struct hid_report_layout * layout = &layouts[i];
+    layout->first_usage_set = num_sets;
+    layout->num_usage_sets = 0;
+    for ( j = layout->first_field; j < layout->first_field + layout->num_fields; j++ ){
+      struct hid_device_element * element = &elements[ fields[j].element_index ];
+      struct hid_usage_set * set = NULL;
+      if ( ( element->type & ( HID_ITEM_CONSTANT | HID_ITEM_VARIABLE ) ) != 0 || element->buffer_size > 0 || element->usage_min < 0 || element->usage_max < element->usage_min ){
+	continue; // a variable, padding, or an array with a usage list we do not handle
       }
+      for ( k = layout->first_usage_set; k < num_sets; k++ ){
+	if ( usage_sets[k].collection_index == element->parent_collection ){
+	  set = &usage_sets[k];
+	  break;
+	}
+      }
+      if ( set == NULL ){
+	set = &usage_sets[ num_sets ];
+	set->index = num_sets;
+	set->collection_index = element->parent_collection;
+	set->usage_page = element->usage_page;
+	set->usage_min = element->usage_min;
+	set->usage_max = element->usage_max;
+	set->report_id = layout->report_id;
+	set->io_type = layout->io_type;
+	num_sets++;
+	layout->num_usage_sets++;
+      }
+      if ( element->usage_min < set->usage_min ){ set->usage_min = element->usage_min; }
+      if ( element->usage_max > set->usage_max ){ set->usage_max = element->usage_max; }
+      fields[j].usage_set = set->index;
+    }
   }
-  return curel; // return the previous element
-  // is NULL
+  for ( i = 0; i < num_sets; i++ ){
+    usage_sets[i].state_offset = descriptor->usage_state_words;
+    usage_sets[i].num_words = ( usage_sets[i].usage_max - usage_sets[i].usage_min ) / 64 + 1;
+    descriptor->usage_state_words += usage_sets[i].num_words;
+    if ( usage_sets[i].num_words > descriptor->max_usage_set_words ){
+      descriptor->max_usage_set_words = usage_sets[i].num_words;
+    }
+  }
+  descriptor->number_of_usage_sets = num_sets;
 }
 
-struct hid_device_element * hid_get_next_output_element( struct hid_device_element * curel ){
-
-  struct hid_device_element * nextel = curel->next;
-  while ( nextel != NULL ){
-      if ( nextel->io_type == 2 ){
-	  return nextel;
-      } else {
-	  nextel = nextel->next;
-      }
-  }
-  return curel; // return the previous element
-  // is NULL
+static inline unsigned int hid_usage_hash( int usage_page, int usage ){
+  return ( ( (unsigned int) usage_page << 16 ) ^ (unsigned int) usage ) * 2654435761U;
 }
 
-struct hid_device_element * hid_get_next_output_element_with_reportid( struct hid_device_element * curel, int reportid ){
-
-  struct hid_device_element * nextel = curel->next;
-  while ( nextel != NULL ){
-      if ( nextel->io_type == 2 && ( nextel->report_id == reportid ) ){
-	  return nextel;
-      } else {
-	  nextel = nextel->next;
+// lookup indexes: a hash from (usage page, usage, occurrence) to element,
+// and the elements of each io type in one list
+static void hid_compile_element_index( struct hid_device_descriptor * descriptor ){
+  struct hid_device_element * elements = HID_DESCRIPTOR_TABLE( descriptor, struct hid_device_element, elements_offset );
+  struct hid_element_key * keys = HID_DESCRIPTOR_TABLE( descriptor, struct hid_element_key, element_keys_offset );
+  int * io_elements = HID_DESCRIPTOR_TABLE( descriptor, int, io_elements_offset );
+  unsigned int mask = descriptor->element_keys_size - 1;
+  int last_of_type[3] = { -1, -1, -1 };
+  int io, i;
+
+  for ( i = 0; i < descriptor->element_keys_size; i++ ){
+    keys[i].element_index = -1;
+  }
+  for ( io = 0; io < 3; io++ ){
+    descriptor->io_count[io] = 0;
+  }
+  for ( i = 0; i < descriptor->num_elements; i++ ){
+    struct hid_device_element * element = &elements[i];
+    unsigned int slot = hid_usage_hash( element->usage_page, element->usage ) & mask;
+    int occurrence = 0;
+    // elements with the same usage are in the same probe sequence, count the earlier ones
+    while ( keys[ slot ].element_index != -1 ){
+      if ( keys[ slot ].usage_page == element->usage_page && keys[ slot ].usage == element->usage ){
+	occurrence++;
       }
+      slot = ( slot + 1 ) & mask;
+    }
+    keys[ slot ].usage_page = element->usage_page;
+    keys[ slot ].usage = element->usage;
+    keys[ slot ].occurrence = occurrence;
+    keys[ slot ].element_index = i;
+
+    io = element->io_type - 1;
+    descriptor->io_count[io]++;
+    element->next_of_type = -1;
+    if ( last_of_type[io] != -1 ){
+      elements[ last_of_type[io] ].next_of_type = i;
+    }
+    last_of_type[io] = i;
+  }
+
+  descriptor->io_first[0] = 0;
+  descriptor->io_first[1] = descriptor->io_count[0];
+  descriptor->io_first[2] = descriptor->io_count[0] + descriptor->io_count[1];
+  for ( io = 0; io < 3; io++ ){
+    descriptor->io_count[io] = 0;
+  }
+  for ( i = 0; i < descriptor->num_elements; i++ ){
+    io = elements[i].io_type - 1;
+    io_elements[ descriptor->io_first[io] + descriptor->io_count[io] ] = i;
+    descriptor->io_count[io]++;
   }
-  return curel; // return the previous element
-  // is NULL
 }
 
-struct hid_device_element * hid_get_next_feature_element( struct hid_device_element * curel ){
+static int hid_bit_run_field( const struct hid_report_field * field ){
+  return field->bit_size == 1 && !field->is_signed && field->usage_set == -1;
+}
 
-  struct hid_device_element * nextel = curel->next;
-  while ( nextel != NULL ){
-      if ( nextel->io_type == 3 ){
-	  return nextel;
-      } else {
-	  nextel = nextel->next;
+// adjacent 1 bit fields (buttons) are decoded as one bit mask; the first field of a run refers to it
+static void hid_compile_bit_runs( struct hid_device_descriptor * descriptor ){
+  struct hid_report_layout * layouts = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_layout, layouts_offset );
+  struct hid_report_field * fields = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_field, fields_offset );
+  struct hid_bit_run * bit_runs = HID_DESCRIPTOR_TABLE( descriptor, struct hid_bit_run, bit_runs_offset );
+  int num_runs = 0;
+  int state_words = 0;
+  int i, j, k;
+
+  for ( i = 0; i < descriptor->number_of_layouts; i++ ){
+    struct hid_report_layout * layout = &layouts[i];
+    int end = layout->first_field + layout->num_fields;
+    for ( j = layout->first_field; j < end; j = k ){
+      k = j + 1;
+      if ( !hid_bit_run_field( &fields[j] ) ){
+	continue;
+      }
+      while ( k < end && hid_bit_run_field( &fields[k] ) && fields[k].bit_offset == fields[k-1].bit_offset + 1 ){
+	k++;
+      }
+      if ( k - j >= HID_MIN_BIT_RUN ){
+	struct hid_bit_run * run = &bit_runs[ num_runs ];
+	run->index = num_runs;
+	run->bit_offset = fields[j].bit_offset;
+	run->num_bits = k - j;
+	run->first_field = j;
+	run->state_offset = state_words;
+	state_words += ( run->num_bits + 63 ) / 64;
+	fields[j].bit_run = num_runs;
+	num_runs++;
       }
+    }
   }
-  return curel; // return the previous element
-  // is NULL
+  descriptor->number_of_bit_runs = num_runs;
+  descriptor->bit_state_words = state_words;
 }
 
-// int hid_parse_input_report( unsigned char* buf, int size, struct hid_device_descriptor * descriptor ){
-int hid_parse_input_report( unsigned char* buf, int size, struct hid_dev_desc * devdesc ){  
-  ///TODO: parse input from descriptors with report size like 12 correctly
-  struct hid_device_collection * device_collection = devdesc->device_collection;
-  // Print out the returned buffer.
-//   struct hid_device_collection * cur_collection = device_collection->first_collection;
-  struct hid_device_element * cur_element = device_collection->first_element;
+static int hid_compile_report_layouts( struct hid_device_descriptor * descriptor ){
+  struct hid_device_element * elements = HID_DESCRIPTOR_TABLE( descriptor, struct hid_device_element, elements_offset );
+  struct hid_report_layout * layouts = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_layout, layouts_offset );
+  struct hid_report_field * fields = HID_DESCRIPTOR_TABLE( descriptor, struct hid_report_field, fields_offset );
+  short * report_dispatch = HID_DESCRIPTOR_TABLE( descriptor, short, dispatch_offset );
+  int * report_ids = HID_DESCRIPTOR_TABLE( descriptor, int, report_ids_offset );
+  float * map = HID_DESCRIPTOR_TABLE( descriptor, float, map_offset );
+  int * value_index = HID_DESCRIPTOR_TABLE( descriptor, int, value_index_offset );
+  int map_stride = descriptor->map_stride;
+  struct hid_device_element * cur_element;
+  int num_elements = descriptor->num_elements;
+  int layout_index[3][256];
+  int bit_offsets[3][256];
+  int num_layouts = 0;
+  int num_fields = 0;
   int i;
-  int next_byte_size;
-  int next_mod_bit_size;
-  int byte_count = 0;
-  int next_val = 0;
 
-//   cur_element = hid_get_next_input_element( cur_element );
-//   if ( cur_element == NULL ){ return 0; }
-  if ( cur_element->io_type != 1 ){
-      cur_element = hid_get_next_input_element(cur_element);
+  memset( layout_index, 0xFF, sizeof( layout_index ) ); // -1: no layout yet
+  memset( bit_offsets, 0, sizeof( bit_offsets ) );
+
+  // first pass: count the layouts and fields
+  for ( i = 0; i < num_elements; i++ ){
+    cur_element = &elements[i];
+    cur_element->field_index = -1;
+    hid_compute_element_map( cur_element );
+    int io = cur_element->io_type - 1;
+    int id = cur_element->report_id & 0xFF;
+    if ( layout_index[io][id] == -1 ){
+      layout_index[io][id] = num_layouts;
+      layouts[ num_layouts ].report_id = cur_element->report_id;
+      layouts[ num_layouts ].io_type = cur_element->io_type;
+      num_layouts++;
+    }
+    if ( ( cur_element->report_size > 0 && cur_element->report_size <= 32 ) || cur_element->buffer_size > 0 ){
+      layouts[ layout_index[io][id] ].num_fields++;
+      num_fields++;
+    }
+  }
+  descriptor->number_of_layouts = num_layouts;
+  descriptor->number_of_fields = num_fields;
+
+  // dispatch table from report id to layout, for each io type
+  memset( report_dispatch, 0xFF, sizeof( short ) * 3 * HID_REPORT_DISPATCH_SIZE );
+  for ( i = 0; i < descriptor->number_of_reports; i++ ){
+    int id = report_ids[i] & 0xFF;
+    int io;
+    for ( io = 0; io < 3; io++ ){
+      report_dispatch[ io * HID_REPORT_DISPATCH_SIZE + id ] = layout_index[io][id];
+    }
+  }
+
+  num_fields = 0;
+  for ( i = 0; i < num_layouts; i++ ){
+    layouts[i].first_field = num_fields;
+    num_fields += layouts[i].num_fields;
+    layouts[i].num_fields = 0;
+  }
+
+  // second pass: fill in the fields, in report order
+  for ( i = 0; i < num_elements; i++ ){
+    cur_element = &elements[i];
+    int io = cur_element->io_type - 1;
+    int id = cur_element->report_id & 0xFF;
+    struct hid_report_layout * layout = &layouts[ layout_index[io][id] ];
+    cur_element->buffer_offset = -1;
+    if ( ( cur_element->report_size > 0 && cur_element->report_size <= 32 ) || cur_element->buffer_size > 0 ){
+      struct hid_report_field * field = &fields[ layout->first_field + layout->num_fields ];
+      if ( cur_element->buffer_size > 0 && ( bit_offsets[io][id] & 7 ) == 0 ){
+	cur_element->buffer_offset = bit_offsets[io][id] >> 3;
+      }
+      field->bit_offset = bit_offsets[io][id];
+      field->bit_size = cur_element->report_size;
+      field->is_signed = ( cur_element->logical_min < 0 );
+      field->element_index = cur_element->index;
+      field->usage_set = -1;
+      field->bit_run = -1;
+      cur_element->field_index = layout->first_field + layout->num_fields;
+      map[ HID_MAP_LOGICAL_SCALE * map_stride + cur_element->field_index ] = cur_element->logical_scale;
+      map[ HID_MAP_LOGICAL_OFFSET * map_stride + cur_element->field_index ] = cur_element->logical_offset;
+      map[ HID_MAP_PHYSICAL_SCALE * map_stride + cur_element->field_index ] = cur_element->physical_scale;
+      map[ HID_MAP_PHYSICAL_OFFSET * map_stride + cur_element->field_index ] = cur_element->physical_offset;
+      value_index[ cur_element->field_index ] = cur_element->index;
+      layout->num_fields++;
+    }
+    bit_offsets[io][id] += cur_element->report_size;
+    layout->report_bits = bit_offsets[io][id];
+  }
+
+  hid_compile_usage_sets( descriptor );
+  hid_compile_bit_runs( descriptor );
+  hid_compile_element_index( descriptor );
+
+  // place each report in the per device report buffer
+  descriptor->report_buffer_size = 0;
+  descriptor->output_buffer_size = 0;
+  for ( i = 0; i < num_layouts; i++ ){
+    layouts[i].report_offset = descriptor->report_buffer_size;
+    descriptor->report_buffer_size += ( layouts[i].report_bits + 7 ) / 8;
+    // reports we send also get the report id byte in front
+    layouts[i].output_offset = -1;
+    if ( layouts[i].io_type != 1 ){
+      layouts[i].output_offset = descriptor->output_buffer_size;
+      descriptor->output_buffer_size += 1 + ( layouts[i].report_bits + 7 ) / 8;
+    }
   }
-  next_byte_size = cur_element->report_size/8;
-  next_mod_bit_size = cur_element->report_size%8;
 
 #ifdef DEBUG_PARSER
-    printf("report_size %i, bytesize %i, bitsize %i \t", cur_element->report_size, next_byte_size, next_mod_bit_size );
-#endif    
-  
-#ifdef DEBUG_PARSER
-  printf("-----------------------\n");
+  for ( i = 0; i < num_layouts; i++ ){
+    printf("layout: report id %i, io type %i, bits %i, fields %i\n", layouts[i].report_id, layouts[i].io_type, layouts[i].report_bits, layouts[i].num_fields );
+  }
 #endif
-  for ( i = 0; i < size; i++){
-    unsigned char curbyte = buf[i];
-#ifdef DEBUG_PARSER    
-    printf("byte %02hhx \t", buf[i]);
-#endif
-    // read byte:    
-    if ( cur_element->report_size < 8 ){
-      int bitindex = 0;
-      while ( bitindex < 8 ){
-	// read bit
-	cur_element->value = (curbyte >> bitindex) & BITMASK1( cur_element->report_size );
-#ifdef DEBUG_PARSER
-	printf("element page %i, usage %i, type %i, index %i, value %i\n", cur_element->usage_page, cur_element->usage, cur_element->type, cur_element->index, cur_element->value );
-#endif
-	bitindex += cur_element->report_size;
-	if ( devdesc->_element_callback != NULL ){
-	  devdesc->_element_callback( cur_element, devdesc->_element_data );
-	}
-	cur_element = hid_get_next_input_element( cur_element );
-// 	if ( cur_element == NULL ){ return 0; }
-	next_byte_size = cur_element->report_size/8;
-	next_mod_bit_size = cur_element->report_size%8;
+  return 0;
+}
 
-#ifdef DEBUG_PARSER
-    printf("report_size %i, bytesize %i, bitsize %i \t", cur_element->report_size, next_byte_size, next_mod_bit_size );
-#endif    
+struct hid_report_layout * hid_get_report_layout( struct hid_dev_desc * devdesc, int io_type, int reportid ){
+  int index;
+  if ( io_type < 1 || io_type > 3 || reportid < 0 || reportid >= HID_REPORT_DISPATCH_SIZE ){
+    return NULL;
+  }
+  index = devdesc->report_dispatch[ (io_type - 1) * HID_REPORT_DISPATCH_SIZE + reportid ];
+  if ( index < 0 ){
+    return NULL;
+  }
+  return &devdesc->layouts[ index ];
+}
+
+// load 64 bits starting at the given byte, little endian; bytes past the end of the buffer read as 0
+static inline uint64_t hid_load_bits( const unsigned char * buf, int size, int byte_offset ){
+  uint64_t bits = 0;
+  if ( byte_offset + 8 <= size ){
+    memcpy( &bits, buf + byte_offset, 8 );
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    bits = __builtin_bswap64( bits );
+#endif
+  } else {
+    int i;
+    for ( i = 0; byte_offset + i < size; i++ ){
+      bits |= ((uint64_t) buf[ byte_offset + i ]) << (8*i);
+    }
+  }
+  return bits;
+}
+
+// 64 bits starting at any bit
+static inline uint64_t hid_load_bits64( const unsigned char * buf, int size, int bit_offset ){
+  int byte_offset = bit_offset >> 3;
+  int shift = bit_offset & 7;
+  uint64_t bits = hid_load_bits( buf, size, byte_offset ) >> shift;
+  if ( shift != 0 && byte_offset + 8 < size ){
+    bits |= ((uint64_t) buf[ byte_offset + 8 ]) << ( 64 - shift );
+  }
+  return bits;
+}
+
+static inline int hid_ctz64( uint64_t bits ){
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64( &index, bits );
+  return (int) index;
+#else
+  return __builtin_ctzll( bits );
+#endif
+}
+
+static inline int hid_extract_field( const unsigned char * buf, int size, const struct hid_report_field * field ){
+  uint64_t bits = hid_load_bits( buf, size, field->bit_offset >> 3 ) >> (field->bit_offset & 7);
+  if ( field->is_signed ){
+    int shift = 64 - field->bit_size;
+    return (int) ( ((int64_t) (bits << shift)) >> shift );
+  }
+  return (int) (uint32_t) ( bits & BITMASK1( field->bit_size ) );
+}
+
+// write a value of any field width into a report, leaving the surrounding bits alone
+static inline void hid_store_field( unsigned char * buf, const struct hid_report_field * field, int value ){
+  int byte_offset = field->bit_offset >> 3;
+  int shift = field->bit_offset & 7;
+  uint64_t mask = BITMASK1( field->bit_size ) << shift;
+  uint64_t bits = ( ((uint64_t) (uint32_t) value) << shift ) & mask;
+  int num_bytes = ( shift + field->bit_size + 7 ) >> 3;
+  int i;
+  for ( i = 0; i < num_bytes; i++ ){
+    buf[ byte_offset + i ] = (unsigned char) ( ( buf[ byte_offset + i ] & ~( mask >> (8*i) ) ) | ( bits >> (8*i) ) );
+  }
+}
+
+// the logical range mapped to 0..1
+float hid_element_map_logical( const struct hid_device_element * element, int value ){
+  return (float) value * element->logical_scale + element->logical_offset;
+}
+
+// logical units per physical unit
+float hid_element_resolution( const struct hid_device_element * element ){
+  if ( element->physical_scale == 0 ){
+    return 0;
+  }
+  return 1.0f / element->physical_scale;
+}
+
+float hid_element_map_physical( const struct hid_device_element * element, int value ){
+  return (float) value * element->physical_scale + element->physical_offset;
+}
+
+// map the values of all fields of a decoded report to floats, one per field in layout order
+int hid_map_report_values( struct hid_dev_desc * devdesc, struct hid_report_layout * layout, float * out, int physical ){
+  struct hid_device_descriptor * descriptor = devdesc->descriptor;
+  const float * map = HID_DESCRIPTOR_TABLE( descriptor, float, map_offset );
+  const int * value_index = HID_DESCRIPTOR_TABLE( descriptor, int, value_index_offset ) + layout->first_field;
+  const float * scale = map + ( physical ? HID_MAP_PHYSICAL_SCALE : HID_MAP_LOGICAL_SCALE ) * descriptor->map_stride + layout->first_field;
+  const float * offset = map + ( physical ? HID_MAP_PHYSICAL_OFFSET : HID_MAP_LOGICAL_OFFSET ) * descriptor->map_stride + layout->first_field;
+  // the values are gathered by the element index of each field
+  const int * values = devdesc->values;
+  int n = layout->num_fields;
+  int i = 0;
+
+#if defined(__AVX2__)
+  for ( ; i + 8 <= n; i += 8 ){
+    __m256i index = _mm256_loadu_si256( (const __m256i *) ( value_index + i ) );
+    __m256 v = _mm256_cvtepi32_ps( _mm256_i32gather_epi32( values, index, 4 ) );
+    __m256 r = _mm256_add_ps( _mm256_mul_ps( v, _mm256_loadu_ps( scale + i ) ), _mm256_loadu_ps( offset + i ) );
+    _mm256_storeu_ps( out + i, r );
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  for ( ; i + 4 <= n; i += 4 ){
+    __m128i raw = _mm_set_epi32( values[ value_index[i+3] ], values[ value_index[i+2] ], values[ value_index[i+1] ], values[ value_index[i] ] );
+    __m128 v = _mm_cvtepi32_ps( raw );
+    __m128 r = _mm_add_ps( _mm_mul_ps( v, _mm_loadu_ps( scale + i ) ), _mm_loadu_ps( offset + i ) );
+    _mm_storeu_ps( out + i, r );
+  }
+#endif
+  for ( ; i < n; i++ ){
+    out[i] = (float) values[ value_index[i] ] * scale[i] + offset[i];
+  }
+  return n;
+}
+
+//// ---------- conditioning
+
+#define HID_MAX_CALIBRATION_SIZE 4096
+
+// the conditioning state lives in one block after its header, set to no deadzone, no smoothing
+static struct hid_conditioning * hid_get_conditioning( struct hid_dev_desc * devd ){
+  struct hid_conditioning * cond = devd->conditioning;
+  int header_size = hid_align( sizeof( struct hid_conditioning ) );
+  int floats_size = hid_align( sizeof( float ) * devd->number_of_fields );
+  int ints_size = hid_align( sizeof( int ) * devd->number_of_fields );
+  char * state;
+  int i;
+  if ( cond != NULL ){
+    return cond;
+  }
+  state = (char *) calloc( header_size + 6 * floats_size + 3 * ints_size + devd->number_of_layouts + 1, 1 );
+  if ( state == NULL ){
+    return NULL;
+  }
+  cond = (struct hid_conditioning *) state;
+  cond->number_of_fields = devd->number_of_fields;
+  cond->center = (float *) ( state + header_size );
+  cond->deadzone = (float *) ( state + header_size + floats_size );
+  cond->gain = (float *) ( state + header_size + 2 * floats_size );
+  cond->alpha = (float *) ( state + header_size + 3 * floats_size );
+  cond->input = (float *) ( state + header_size + 4 * floats_size );
+  cond->output = (float *) ( state + header_size + 5 * floats_size );
+  cond->lut_offset = (int *) ( state + header_size + 6 * floats_size );
+  cond->lut_base = (int *) ( state + header_size + 6 * floats_size + ints_size );
+  cond->lut_last = (int *) ( state + header_size + 6 * floats_size + 2 * ints_size );
+  cond->primed = (unsigned char *) ( state + header_size + 6 * floats_size + 3 * ints_size );
+  for ( i = 0; i < cond->number_of_fields; i++ ){
+    cond->center[i] = 0.5f;
+    cond->gain[i] = 1.0f;
+    cond->alpha[i] = 1.0f;
+    cond->lut_offset[i] = -1;
+  }
+  devd->conditioning = cond;
+  return cond;
+}
+
+// the field of an input element with a plain value, -1 if it has none
+static int hid_conditioned_field( struct hid_device_element * element ){
+  if ( element == NULL || element->io_type != HID_REPORT_TYPE_INPUT || element->field_index < 0 || element->buffer_size > 0 ){
+    return -1;
+  }
+  return element->field_index;
+}
+
+int hid_set_deadzone( struct hid_dev_desc * devd, struct hid_device_element * element, float deadzone, float center ){
+  struct hid_conditioning * cond;
+  int field = hid_conditioned_field( element );
+  float side = center > 0.5f ? center : 1.0f - center;
+  if ( field < 0 || center < 0.0f || center > 1.0f || deadzone < 0.0f || deadzone >= side ){
+    return -1;
+  }
+  cond = hid_get_conditioning( devd );
+  if ( cond == NULL ){
+    return -1;
+  }
+  cond->center[ field ] = center;
+  cond->deadzone[ field ] = deadzone;
+  cond->gain[ field ] = side / ( side - deadzone );
+  return 0;
+}
+
+int hid_set_smoothing( struct hid_dev_desc * devd, struct hid_device_element * element, float alpha ){
+  struct hid_conditioning * cond;
+  int field = hid_conditioned_field( element );
+  if ( field < 0 || alpha <= 0.0f || alpha > 1.0f ){
+    return -1;
+  }
+  cond = hid_get_conditioning( devd );
+  if ( cond == NULL ){
+    return -1;
+  }
+  cond->alpha[ field ] = alpha;
+  return 0;
+}
+
+// copies the tables into a new block without the one of skip_field, with room for extra floats
+// at the end, so that replaced and removed tables leave no unused space behind
+static int hid_compact_luts( struct hid_conditioning * cond, int skip_field, int extra ){
+  float * luts = NULL;
+  int luts_size = 0;
+  int i;
+  for ( i = 0; i < cond->number_of_fields; i++ ){
+    if ( i != skip_field && cond->lut_offset[i] >= 0 ){
+      luts_size += cond->lut_last[i] + 1;
+    }
+  }
+  if ( luts_size + extra > 0 ){
+    luts = (float *) malloc( sizeof( float ) * ( luts_size + extra ) );
+    if ( luts == NULL ){
+      return -1;
+    }
+  }
+  luts_size = 0;
+  for ( i = 0; i < cond->number_of_fields; i++ ){
+    if ( i != skip_field && cond->lut_offset[i] >= 0 ){
+      memcpy( luts + luts_size, cond->luts + cond->lut_offset[i], sizeof( float ) * ( cond->lut_last[i] + 1 ) );
+      cond->lut_offset[i] = luts_size;
+      luts_size += cond->lut_last[i] + 1;
+    }
+  }
+  free( cond->luts );
+  cond->luts = luts;
+  cond->luts_size = luts_size;
+  return 0;
+}
+
+// a NULL table removes the calibration, the mapping to 0..1 is used again
+int hid_set_calibration( struct hid_dev_desc * devd, struct hid_device_element * element, const float * table, int size ){
+  struct hid_conditioning * cond;
+  int field = hid_conditioned_field( element );
+  if ( field < 0 ){
+    return -1;
+  }
+  cond = hid_get_conditioning( devd );
+  if ( cond == NULL ){
+    return -1;
+  }
+  if ( table == NULL ){
+    if ( cond->lut_offset[ field ] >= 0 ){
+      if ( hid_compact_luts( cond, field, 0 ) != 0 ){
+	return -1;
       }
-    } else if ( cur_element->report_size == 8 ){
-	cur_element->value = curbyte;
-#ifdef DEBUG_PARSER
-	printf("element page %i, usage %i, type %i,  index %i, value %i\n", cur_element->usage_page, cur_element->usage, cur_element->type, cur_element->index,cur_element->value );
+      cond->lut_offset[ field ] = -1;
+      cond->number_of_luts--;
+    }
+    return 0;
+  }
+  if ( size != element->logical_max - element->logical_min + 1 || size > HID_MAX_CALIBRATION_SIZE ){
+    return -1;
+  }
+  if ( cond->lut_offset[ field ] < 0 || cond->lut_last[ field ] + 1 != size ){
+    // a table of the same size is overwritten in place, otherwise it moves to the end
+    if ( hid_compact_luts( cond, field, size ) != 0 ){
+      return -1;
+    }
+    if ( cond->lut_offset[ field ] < 0 ){
+      cond->number_of_luts++;
+    }
+    cond->lut_offset[ field ] = cond->luts_size;
+    cond->luts_size += size;
+  }
+  cond->lut_base[ field ] = element->logical_min;
+  cond->lut_last[ field ] = size - 1;
+  memcpy( cond->luts + cond->lut_offset[ field ], table, sizeof( float ) * size );
+  return 0;
+}
+
+float hid_get_conditioned_value( struct hid_dev_desc * devd, struct hid_device_element * element ){
+  int field = hid_conditioned_field( element );
+  if ( devd->conditioning == NULL || field < 0 ){
+    return hid_element_map_logical( element, devd->values[ element->index ] );
+  }
+  return devd->conditioning->output[ field ];
+}
+
+// the conditioned values of a report in layout order, NULL without conditioning
+const float * hid_get_conditioned_values( struct hid_dev_desc * devd, struct hid_report_layout * layout ){
+  if ( devd->conditioning == NULL ){
+    return NULL;
+  }
+  return devd->conditioning->output + layout->first_field;
+}
+
+// condition the values of a decoded input report: map (or look up), then deadzone and smoothing
+static void hid_condition_report( struct hid_dev_desc * devdesc, struct hid_report_layout * layout ){
+  struct hid_conditioning * cond = devdesc->conditioning;
+  int first = layout->first_field;
+  int n = layout->num_fields;
+  int layout_index = (int) ( layout - devdesc->layouts );
+  const float * center = cond->center + first;
+  const float * deadzone = cond->deadzone + first;
+  const float * gain = cond->gain + first;
+  const float * alpha = cond->alpha + first;
+  float * x = cond->input + first;
+  float * y = cond->output + first;
+  int prime = !cond->primed[ layout_index ]; // the first report sets the smoothed values directly
+  int i;
+
+  hid_map_report_values( devdesc, layout, x, 0 );
+  if ( cond->number_of_luts > 0 ){
+    const int * value_index = HID_DESCRIPTOR_TABLE( devdesc->descriptor, int, value_index_offset ) + first;
+    for ( i = 0; i < n; i++ ){
+      int offset = cond->lut_offset[ first + i ];
+      if ( offset >= 0 ){
+	int v = devdesc->values[ value_index[i] ] - cond->lut_base[ first + i ];
+	v = v < 0 ? 0 : ( v > cond->lut_last[ first + i ] ? cond->lut_last[ first + i ] : v );
+	x[i] = cond->luts[ offset + v ];
+      }
+    }
+  }
+
+  // d = x - center, what is outside the deadzone d - clamp( d, -deadzone, deadzone ) is
+  // rescaled around the center, then y += alpha * ( target - y )
+  i = 0;
+#if defined(__AVX2__)
+  {
+    const __m256 one = _mm256_set1_ps( 1.0f );
+    const __m256 zero = _mm256_setzero_ps();
+    for ( ; i + 8 <= n; i += 8 ){
+      __m256 c = _mm256_loadu_ps( center + i );
+      __m256 dz = _mm256_loadu_ps( deadzone + i );
+      __m256 d = _mm256_sub_ps( _mm256_loadu_ps( x + i ), c );
+      __m256 outside = _mm256_sub_ps( d, _mm256_max_ps( _mm256_min_ps( d, dz ), _mm256_sub_ps( zero, dz ) ) );
+      __m256 target = _mm256_add_ps( c, _mm256_mul_ps( outside, _mm256_loadu_ps( gain + i ) ) );
+      __m256 a = prime ? one : _mm256_loadu_ps( alpha + i );
+      __m256 prev = _mm256_loadu_ps( y + i );
+      _mm256_storeu_ps( y + i, _mm256_add_ps( prev, _mm256_mul_ps( a, _mm256_sub_ps( target, prev ) ) ) );
+    }
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  {
+    const __m128 one = _mm_set1_ps( 1.0f );
+    const __m128 zero = _mm_setzero_ps();
+    for ( ; i + 4 <= n; i += 4 ){
+      __m128 c = _mm_loadu_ps( center + i );
+      __m128 dz = _mm_loadu_ps( deadzone + i );
+      __m128 d = _mm_sub_ps( _mm_loadu_ps( x + i ), c );
+      __m128 outside = _mm_sub_ps( d, _mm_max_ps( _mm_min_ps( d, dz ), _mm_sub_ps( zero, dz ) ) );
+      __m128 target = _mm_add_ps( c, _mm_mul_ps( outside, _mm_loadu_ps( gain + i ) ) );
+      __m128 a = prime ? one : _mm_loadu_ps( alpha + i );
+      __m128 prev = _mm_loadu_ps( y + i );
+      _mm_storeu_ps( y + i, _mm_add_ps( prev, _mm_mul_ps( a, _mm_sub_ps( target, prev ) ) ) );
+    }
+  }
 #endif
-	if ( devdesc->_element_callback != NULL ){
-	  devdesc->_element_callback( cur_element, devdesc->_element_data );
-	}
-	cur_element = hid_get_next_input_element( cur_element );
-// 	if ( cur_element == NULL ){ return 0; }
-	next_byte_size = cur_element->report_size/8;
-	next_mod_bit_size = cur_element->report_size%8;
-	
-#ifdef DEBUG_PARSER
-    printf("report_size %i, bytesize %i, bitsize %i \t", cur_element->report_size, next_byte_size, next_mod_bit_size );
-#endif    
-    } else if ( cur_element->report_size == 16 ){
-      int shift = byte_count*8;
-      next_val |= (int)(((unsigned char)(curbyte)) << shift);
-#ifdef DEBUG_PARSER
-      printf("\t nextval shift: %i", next_val);
+  for ( ; i < n; i++ ){
+    float d = x[i] - center[i];
+    float inside = d < -deadzone[i] ? -deadzone[i] : ( d > deadzone[i] ? deadzone[i] : d );
+    float target = center[i] + ( d - inside ) * gain[i];
+    y[i] += ( prime ? 1.0f : alpha[i] ) * ( target - y[i] );
+  }
+  cond->primed[ layout_index ] = 1;
+}
+
+void hid_element_set_rawvalue( struct hid_dev_desc * devd, struct hid_device_element * element, int value ){
+  hid_store_value( devd, element->index, value );
+}
+
+void hid_element_set_logicalvalue( struct hid_dev_desc * devd, struct hid_device_element * element, float value ){
+  int mapvalue;
+  mapvalue = (int) ( value * ( (float) element->logical_max - (float) element->logical_min ) ) + element->logical_min;
+  hid_store_value( devd, element->index, mapvalue );
+}
+
+// view of the bytes of a byte run element in the last report decoded for it, no copy is made;
+// the data is that of the buffer passed to the parser (or the device's copy in changes only mode)
+const unsigned char * hid_get_element_buffer( struct hid_dev_desc * devdesc, struct hid_device_element * element, int * length ){
+  struct hid_report_layout * layout;
+  const unsigned char * data;
+  *length = 0;
+  if ( element->buffer_size <= 0 || element->buffer_offset < 0 ){
+    return NULL;
+  }
+  layout = hid_get_report_layout( devdesc, element->io_type, element->report_id );
+  if ( layout == NULL ){
+    return NULL;
+  }
+  data = devdesc->report_data[ layout - devdesc->layouts ];
+  if ( data == NULL ){
+    return NULL;
+  }
+  *length = devdesc->values[ element->index ];
+  return data + element->buffer_offset;
+}
+
+struct hid_device_element * hid_get_element( struct hid_dev_desc * devdesc, int index ){
+  if ( index < 0 || index >= devdesc->descriptor->num_elements ){
+    return NULL;
+  }
+  return &devdesc->elements[ index ];
+}
+
+int hid_get_element_value( struct hid_dev_desc * devdesc, int index ){
+  if ( index < 0 || index >= devdesc->descriptor->num_elements ){
+    return 0;
+  }
+  return HID_LOAD_RELAXED( &devdesc->values[ index ] );
+}
+
+unsigned int hid_get_values_sequence( struct hid_dev_desc * devdesc ){
+  unsigned int sequence = HID_LOAD_RELAXED( &devdesc->values_sequence );
+  HID_FENCE_ACQUIRE();
+  return sequence;
+}
+
+// copy the values as they were after one report, retrying while the decoding thread writes them
+unsigned int hid_snapshot_values( struct hid_dev_desc * devdesc, const int * indices, int count, int * values ){
+  unsigned int begin;
+  unsigned int end;
+  int i;
+  do {
+    begin = HID_LOAD_RELAXED( &devdesc->values_sequence );
+    HID_FENCE_ACQUIRE();
+    if ( indices == NULL ){
+      for ( i = 0; i < count; i++ ){
+	values[i] = HID_LOAD_RELAXED( &devdesc->values[i] );
+      }
+    } else {
+      for ( i = 0; i < count; i++ ){
+	values[i] = HID_LOAD_RELAXED( &devdesc->values[ indices[i] ] );
+      }
+    }
+    HID_FENCE_ACQUIRE();
+    end = HID_LOAD_RELAXED( &devdesc->values_sequence );
+  } while ( ( begin & 1 ) != 0 || begin != end );
+  return begin;
+}
+
+unsigned int hid_snapshot_report_values( struct hid_dev_desc * devdesc, struct hid_report_layout * layout, int * values ){
+  const int * value_index = HID_DESCRIPTOR_TABLE( devdesc->descriptor, int, value_index_offset ) + layout->first_field;
+  return hid_snapshot_values( devdesc, value_index, layout->num_fields, values );
+}
+
+// occurrence counts elements with the same usage page and usage, in descriptor order from 0
+struct hid_device_element * hid_find_element_by_usage( struct hid_dev_desc * devdesc, int usage_page, int usage, int occurrence ){
+  struct hid_device_descriptor * descriptor = devdesc->descriptor;
+  const struct hid_element_key * keys = HID_DESCRIPTOR_TABLE( descriptor, struct hid_element_key, element_keys_offset );
+  unsigned int mask = descriptor->element_keys_size - 1;
+  unsigned int slot = hid_usage_hash( usage_page, usage ) & mask;
+  while ( keys[ slot ].element_index != -1 ){
+    if ( keys[ slot ].usage_page == usage_page && keys[ slot ].usage == usage && keys[ slot ].occurrence == occurrence ){
+      return &devdesc->elements[ keys[ slot ].element_index ];
+    }
+    slot = ( slot + 1 ) & mask;
+  }
+  return NULL;
+}
+
+// indices of the elements of one io type, in descriptor order
+const int * hid_get_io_elements( struct hid_dev_desc * devdesc, int io_type, int * count ){
+  struct hid_device_descriptor * descriptor = devdesc->descriptor;
+  if ( io_type < 1 || io_type > 3 ){
+    *count = 0;
+    return NULL;
+  }
+  *count = descriptor->io_count[ io_type - 1 ];
+  return HID_DESCRIPTOR_TABLE( descriptor, int, io_elements_offset ) + descriptor->io_first[ io_type - 1 ];
+}
+
+// elements are stored contiguously and each one knows the next of its io type
+static struct hid_device_element * hid_get_next_element_of_type( struct hid_device_element * curel, int io_type ){
+  struct hid_device_element * nextel = curel;
+  if ( nextel->io_type != io_type ){
+    while ( nextel->next != -1 ){
+      nextel = nextel + 1;
+      if ( nextel->io_type == io_type ){
+	return nextel;
+      }
+    }
+    return curel; // return the previous element
+  }
+  if ( nextel->next_of_type == -1 ){
+    return curel;
+  }
+  return curel + ( curel->next_of_type - curel->index );
+}
+
+struct hid_device_element * hid_get_next_input_element( struct hid_device_element * curel ){
+  return hid_get_next_element_of_type( curel, 1 );
+}
+
+struct hid_device_element * hid_get_next_output_element( struct hid_device_element * curel ){
+  return hid_get_next_element_of_type( curel, 2 );
+}
+
+struct hid_device_element * hid_get_next_output_element_with_reportid( struct hid_device_element * curel, int reportid ){
+  struct hid_device_element * nextel = hid_get_next_element_of_type( curel, 2 );
+  while ( nextel != curel && nextel->report_id != reportid ){
+    struct hid_device_element * prevel = nextel;
+    nextel = hid_get_next_element_of_type( prevel, 2 );
+    if ( nextel == prevel ){
+      return curel; // return the previous element
+    }
+  }
+  return nextel;
+}
+
+struct hid_device_element * hid_get_next_feature_element( struct hid_device_element * curel ){
+  return hid_get_next_element_of_type( curel, 3 );
+}
+
+unsigned long long hid_timestamp_now( void ){
+#ifdef _WIN32
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter( &counter );
+  QueryPerformanceFrequency( &frequency );
+  return (unsigned long long) ( (double) counter.QuadPart * 1e9 / (double) frequency.QuadPart );
+#else
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
 #endif
-     byte_count++;
-      if ( byte_count == next_byte_size ){
-	  cur_element->value = next_val;
-	  
+}
+
+// int hid_parse_input_report( unsigned char* buf, int size, struct hid_device_descriptor * descriptor ){
+int hid_parse_input_report( unsigned char* buf, int size, struct hid_dev_desc * devdesc ){
+  unsigned long long timestamp = 0;
+  if ( devdesc->_report_callback != NULL ){
+    timestamp = hid_timestamp_now();
+  }
+  return hid_parse_input_report_timed( buf, size, devdesc, timestamp );
+}
+
+int hid_parse_input_report_timed( unsigned char* buf, int size, struct hid_dev_desc * devdesc, unsigned long long timestamp ){
+  int reportid = 0;
+  if ( devdesc->number_of_reports > 1 ){
+    // numbered reports: the first byte is the report id
+    if ( size < 1 ){ return -1; }
+    reportid = buf[0];
+    buf++;
+    size--;
+  }
+  return hid_decode_report( buf, size, devdesc, hid_get_report_layout( devdesc, HID_REPORT_TYPE_INPUT, reportid ), timestamp );
+}
+
+// feature reports as returned by hid_get_feature_report() always start with the report id, also when it is 0
+int hid_parse_feature_report( unsigned char* buf, int size, struct hid_dev_desc * devdesc ){
+  unsigned long long timestamp = 0;
+  if ( size < 1 ){
+    return -1;
+  }
+  if ( devdesc->_report_callback != NULL ){
+    timestamp = hid_timestamp_now();
+  }
+  return hid_decode_report( buf + 1, size - 1, devdesc, hid_get_report_layout( devdesc, HID_REPORT_TYPE_FEATURE, buf[0] ), timestamp );
+}
+
+// mark the usage of one array slot as pressed in the next state of its set
+static inline void hid_add_pressed_usage( struct hid_dev_desc * devdesc, const struct hid_usage_set * set, const struct hid_device_element * element, int value ){
+  int usage;
+  if ( devdesc->usage_update[ set->index ] == HID_USAGE_SET_SKIPPED ){
+    devdesc->usage_update[ set->index ] = HID_USAGE_SET_DECODED;
+  }
+  if ( value < element->logical_min || value > element->logical_max ){
+    return; // out of range means no usage
+  }
+  usage = element->usage_min + ( value - element->logical_min );
+  if ( usage == 0 || usage > element->usage_max ){
+    return; // usage 0 is reserved, it is sent for empty slots
+  }
+  if ( set->usage_page == HID_USAGE_PAGE_KEYBOARD && usage <= HID_KEYBOARD_ERROR_UNDEFINED ){
+    devdesc->usage_update[ set->index ] = HID_USAGE_SET_ROLLOVER;
+    return;
+  }
+  usage -= set->usage_min;
+  devdesc->usage_next[ set->state_offset + ( usage >> 6 ) ] |= 1ULL << ( usage & 63 );
+}
+
+// diff the new usage sets of a report against the previous ones and report presses and releases
+static void hid_update_usage_sets( struct hid_dev_desc * devdesc, const struct hid_report_layout * layout ){
+  int i, w;
+  for ( i = layout->first_usage_set; i < layout->first_usage_set + layout->num_usage_sets; i++ ){
+    const struct hid_usage_set * set = &devdesc->usage_sets[i];
+    unsigned long long * state = devdesc->usage_state + set->state_offset;
+    unsigned long long * next = devdesc->usage_next + set->state_offset;
+    unsigned long long any = 0;
+    if ( devdesc->usage_update[i] != HID_USAGE_SET_DECODED ){
+      continue; // keep the previous state
+    }
+    for ( w = 0; w < set->num_words; w++ ){
+      devdesc->usage_pressed[w] = next[w] & ~state[w];
+      devdesc->usage_released[w] = state[w] & ~next[w];
+      any |= devdesc->usage_pressed[w] | devdesc->usage_released[w];
+      state[w] = next[w];
+    }
+    if ( any != 0 && devdesc->_usage_callback != NULL ){
+      devdesc->_usage_callback( devdesc, set, devdesc->usage_pressed, devdesc->usage_released, devdesc->_usage_data );
+    }
+  }
+}
+
+int hid_usage_is_pressed( struct hid_dev_desc * devdesc, int set_index, int usage ){
+  const struct hid_usage_set * set;
+  if ( set_index < 0 || set_index >= devdesc->number_of_usage_sets ){
+    return 0;
+  }
+  set = &devdesc->usage_sets[ set_index ];
+  if ( usage < set->usage_min || usage > set->usage_max ){
+    return 0;
+  }
+  usage -= set->usage_min;
+  return ( devdesc->usage_state[ set->state_offset + ( usage >> 6 ) ] >> ( usage & 63 ) ) & 1;
+}
+
+const unsigned long long * hid_get_pressed_usages( struct hid_dev_desc * devdesc, int set_index ){
+  if ( set_index < 0 || set_index >= devdesc->number_of_usage_sets ){
+    return NULL;
+  }
+  return devdesc->usage_state + devdesc->usage_sets[ set_index ].state_offset;
+}
+
+// decode a run of 1 bit fields 64 at a time; in changes only mode only the bits that differ
+// from the previous mask are visited
+static struct hid_element_change * hid_decode_bit_run( const unsigned char * buf, int size, struct hid_dev_desc * devdesc, const struct hid_bit_run * run, struct hid_element_change * change ){
+  const struct hid_report_field * fields = devdesc->fields + run->first_field;
+  unsigned long long * state = devdesc->bit_state + run->state_offset;
+  int w;
+  for ( w = 0; w * 64 < run->num_bits; w++ ){
+    int num_bits = run->num_bits - w * 64;
+    uint64_t mask = num_bits >= 64 ? ~0ULL : BITMASK1( num_bits );
+    uint64_t bits = hid_load_bits64( buf, size, run->bit_offset + w * 64 ) & mask;
+    uint64_t visit = devdesc->changes_only ? ( bits ^ state[w] ) : mask;
+    state[w] = bits;
+    while ( visit != 0 ){
+      int i = hid_ctz64( visit );
+      const struct hid_report_field * field = &fields[ w * 64 + i ];
+      int value = (int) ( ( bits >> i ) & 1 );
+      visit &= visit - 1;
+      hid_store_value( devdesc, field->element_index, value );
+      change->index = field->element_index;
+      change->value = value;
+      change++;
+      if ( devdesc->_element_callback != NULL ){
+	devdesc->_element_callback( &devdesc->elements[ field->element_index ], value, devdesc->_element_data );
+      }
+    }
+  }
+  return change;
+}
+
+// the bits of a run as last decoded, bit i is field first_field + i
+const unsigned long long * hid_get_bit_run_state( struct hid_dev_desc * devdesc, int run_index ){
+  if ( run_index < 0 || run_index >= devdesc->number_of_bit_runs ){
+    return NULL;
+  }
+  return devdesc->bit_state + devdesc->bit_runs[ run_index ].state_offset;
+}
+
+// expand a bit mask to one byte (0 or 1) per bit
+void hid_unpack_bits( const unsigned long long * bits, int num_bits, unsigned char * out ){
+  int i = 0;
+#if defined(__BMI2__)
+  for ( ; i + 8 <= num_bits; i += 8 ){
+    uint64_t bytes = _pdep_u64( ( bits[ i >> 6 ] >> ( i & 63 ) ) & 0xFF, 0x0101010101010101ULL );
+    memcpy( out + i, &bytes, 8 ); // little endian: bit 0 goes to the first byte
+  }
+#elif defined(__SSSE3__)
+  const __m128i spread = _mm_set_epi8( 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0 );
+  const __m128i select = _mm_set_epi8( -128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1 );
+  const __m128i one = _mm_set1_epi8( 1 );
+  for ( ; i + 16 <= num_bits; i += 16 ){
+    __m128i v = _mm_set1_epi16( (short) ( ( bits[ i >> 6 ] >> ( i & 63 ) ) & 0xFFFF ) );
+    v = _mm_and_si128( _mm_shuffle_epi8( v, spread ), select );
+    v = _mm_and_si128( _mm_cmpeq_epi8( v, select ), one );
+    _mm_storeu_si128( (__m128i *) ( out + i ), v );
+  }
+#endif
+  for ( ; i < num_bits; i++ ){
+    out[i] = (unsigned char) ( ( bits[ i >> 6 ] >> ( i & 63 ) ) & 1 );
+  }
+}
+
+// decode the data of one report (after the report id) with its compiled layout
+static int hid_decode_report( unsigned char* buf, int size, struct hid_dev_desc * devdesc, struct hid_report_layout * layout, unsigned long long timestamp ){
+  struct hid_report_field * field;
+  struct hid_report_field * last_field;
+  struct hid_element_change * change = devdesc->changes;
+  const int * decoded = NULL; // field values from the generated decoder, in layout order
+  int reportid;
+  int size_bits;
+
+  if ( layout == NULL ){
+    return -1;
+  }
+  reportid = layout->report_id;
+
 #ifdef DEBUG_PARSER
-	  printf("element page %i, usage %i, type %i,  index %i, value %i\n", cur_element->usage_page, cur_element->usage, cur_element->type, cur_element->index,cur_element->value );
+  printf("-----------------------\n");
+  printf("report id %i, size %i, fields %i\n", reportid, size, layout->num_fields );
 #endif
-	  if ( devdesc->_element_callback != NULL ){
-	    devdesc->_element_callback( cur_element, devdesc->_element_data );
-	  }
-	  cur_element = hid_get_next_input_element( cur_element );
-// 	  if ( cur_element == NULL ){ break; }
-	  next_byte_size = cur_element->report_size/8;
-	  next_mod_bit_size = cur_element->report_size%8;
-	 
-#ifdef DEBUG_PARSER
-    printf("report_size %i, bytesize %i, bitsize %i \t", cur_element->report_size, next_byte_size, next_mod_bit_size );
-#endif    
-	  byte_count = 0;
-	  next_val = 0;
+  devdesc->report_data[ layout - devdesc->layouts ] = buf;
+  if ( devdesc->changes_only ){
+    // skip the whole report if it is the same as the previous one
+    unsigned char * last_report = devdesc->report_buffer + layout->report_offset;
+    int report_bytes = ( layout->report_bits + 7 ) / 8;
+    devdesc->report_data[ layout - devdesc->layouts ] = last_report; // keeps the data until the next report
+    if ( size < report_bytes ){
+      report_bytes = size;
+    }
+    if ( devdesc->report_seen[ layout - devdesc->layouts ] && memcmp( last_report, buf, report_bytes ) == 0 ){
+      // no value changed, but smoothing still moves the conditioned values towards them
+      if ( devdesc->conditioning != NULL && layout->io_type == HID_REPORT_TYPE_INPUT ){
+	hid_condition_report( devdesc, layout );
       }
+      return 0;
     }
+    memcpy( last_report, buf, report_bytes );
+    devdesc->report_seen[ layout - devdesc->layouts ] = 1;
   }
-  
-#ifdef DEBUG_PARSER  
-  printf("\n");
+
+  if ( layout->num_usage_sets > 0 ){
+    struct hid_usage_set * first_set = &devdesc->usage_sets[ layout->first_usage_set ];
+    struct hid_usage_set * end_set = first_set + layout->num_usage_sets;
+    memset( devdesc->usage_next + first_set->state_offset, 0, sizeof( unsigned long long ) * ( (end_set-1)->state_offset + (end_set-1)->num_words - first_set->state_offset ) );
+    memset( devdesc->usage_update + layout->first_usage_set, HID_USAGE_SET_SKIPPED, layout->num_usage_sets );
+  }
+
+  size_bits = size * 8;
+  if ( devdesc->subscribed_fields != NULL ){
+    // only the fields of the subscribed usages
+    int layout_index = (int) ( layout - devdesc->layouts );
+    field = devdesc->subscribed_fields + devdesc->subscribed_ranges[ 2*layout_index ];
+    last_field = field + devdesc->subscribed_ranges[ 2*layout_index + 1 ];
+  } else {
+    field = devdesc->fields + layout->first_field;
+    last_field = field + layout->num_fields;
+    if ( devdesc->_decoder != NULL && layout->io_type == 1 &&
+	 devdesc->_decoder( buf, size, reportid, devdesc->decoded_values ) == layout->num_fields ){
+      decoded = devdesc->decoded_values;
+    }
+  }
+  hid_values_write_begin( devdesc );
+  for ( ; field < last_field; field++ ){
+    if ( field->bit_offset + field->bit_size > size_bits ){
+      break; // short report
+    }
+    if ( field->bit_run >= 0 ){
+      const struct hid_bit_run * run = &devdesc->bit_runs[ field->bit_run ];
+      if ( run->bit_offset + run->num_bits <= size_bits ){
+	change = hid_decode_bit_run( buf, size, devdesc, run, change );
+	field += run->num_bits - 1;
+	continue;
+      }
+    }
+    struct hid_device_element * cur_element = &devdesc->elements[ field->element_index ];
+    int value;
+    if ( field->bit_size > 32 ){
+      value = field->bit_size >> 3; // byte run: the value is its length, the data is read with hid_get_element_buffer
+    } else if ( decoded != NULL ){
+      value = decoded[ field - devdesc->fields - layout->first_field ];
+    } else {
+      value = hid_extract_field( buf, size, field );
+    }
+    if ( field->usage_set >= 0 ){
+      hid_add_pressed_usage( devdesc, &devdesc->usage_sets[ field->usage_set ], cur_element, value );
+    }
+    if ( devdesc->changes_only && value == devdesc->values[ field->element_index ] && field->bit_size <= 32 ){
+      continue;
+    }
+    hid_store_value( devdesc, field->element_index, value );
+    change->index = field->element_index;
+    change->value = value;
+    change++;
+#ifdef DEBUG_PARSER
+    printf("element page %i, usage %i, type %i, index %i, value %i\n", cur_element->usage_page, cur_element->usage, cur_element->type, cur_element->index, value );
 #endif
+    if ( devdesc->_element_callback != NULL ){
+      devdesc->_element_callback( cur_element, value, devdesc->_element_data );
+    }
+  }
+  hid_values_write_end( devdesc );
+
+  if ( layout->num_usage_sets > 0 ){
+    hid_update_usage_sets( devdesc, layout );
+  }
+  if ( devdesc->conditioning != NULL && layout->io_type == HID_REPORT_TYPE_INPUT ){
+    hid_condition_report( devdesc, layout );
+  }
+  if ( devdesc->_report_callback != NULL && change != devdesc->changes ){
+    devdesc->_report_callback( devdesc, reportid, timestamp, devdesc->changes, (int) (change - devdesc->changes), devdesc->_report_data );
+  }
   if ( devdesc->_descriptor_callback != NULL ){
     devdesc->_descriptor_callback( devdesc, devdesc->_descriptor_data );
   }
   return 0;
 }
 
-int hid_send_output_report( struct hid_dev_desc * devd, int reportid ){
-  char * buf;
-  // find the right report id
-  int index = 0;
+// decode one field of many reports into a column
+static void hid_decode_field_column( const unsigned char * data, int report_size, int report_stride, int num_reports, const struct hid_report_field * field, int * column ){
+  int r = 0;
+  if ( field->bit_size > 32 ){
+    // byte run: the value is its length
+    for ( ; r < num_reports; r++ ){
+      column[r] = field->bit_size >> 3;
+    }
+    return;
+  }
+#if defined(__AVX2__)
+  // eight reports at a time: gather 64 bits at the field's byte in each, shift and mask in 32 bit lanes
+  if ( ( field->bit_offset >> 3 ) + 8 <= report_size && (long long) report_stride * num_reports < 0x7FFFFFFF ){
+    const __m256i shift = _mm256_set1_epi64x( field->bit_offset & 7 );
+    const __m256i pack = _mm256_setr_epi32( 0, 2, 4, 6, 1, 3, 5, 7 );
+    const __m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+    const __m256i stride = _mm256_set1_epi32( report_stride );
+    const int up = 32 - field->bit_size;
+    const __m256i mask = _mm256_set1_epi32( (int) (uint32_t) BITMASK1( field->bit_size ) );
+    const long long * base = (const long long *) ( data + ( field->bit_offset >> 3 ) );
+    for ( ; r + 8 <= num_reports; r += 8 ){
+      __m256i offsets = _mm256_mullo_epi32( _mm256_add_epi32( _mm256_set1_epi32( r ), lane ), stride );
+      __m256i lo = _mm256_srlv_epi64( _mm256_i32gather_epi64( base, _mm256_castsi256_si128( offsets ), 1 ), shift );
+      __m256i hi = _mm256_srlv_epi64( _mm256_i32gather_epi64( base, _mm256_extracti128_si256( offsets, 1 ), 1 ), shift );
+      // low 32 bits of each 64 bit lane, in report order
+      __m256i v = _mm256_permute2x128_si256( _mm256_permutevar8x32_epi32( lo, pack ), _mm256_permutevar8x32_epi32( hi, pack ), 0x20 );
+      if ( field->is_signed ){
+	v = _mm256_srai_epi32( _mm256_slli_epi32( v, up ), up );
+      } else {
+	v = _mm256_and_si256( v, mask );
+      }
+      _mm256_storeu_si256( (__m256i *) ( column + r ), v );
+    }
+  }
+#endif
+  for ( ; r < num_reports; r++ ){
+    column[r] = hid_extract_field( data + (size_t) r * report_stride, report_size, field );
+  }
+}
+
+// decode many reports of one report id into columns: the values of field i of the layout go to
+// columns + i * column_stride, one per report, and the timestamps (now if NULL) to timestamp_column;
+// the reports are report_size bytes each, report_stride apart, starting with the report id if the
+// device numbers its reports. The elements get the values of the last report, no callbacks are made.
+// Returns the number of columns.
+int hid_decode_report_batch( struct hid_dev_desc * devdesc, int reportid, const unsigned char * reports, int report_size, int report_stride, int num_reports, const unsigned long long * timestamps, int * columns, int column_stride, unsigned long long * timestamp_column ){
+  struct hid_report_layout * layout = hid_get_report_layout( devdesc, HID_REPORT_TYPE_INPUT, reportid );
+  const unsigned char * data = reports;
   int i;
-  for ( i=0; i<devd->number_of_reports; i++ ){
-    if ( reportid == devd->report_ids[i] ){
-      index = i;
-      break;
+
+  if ( layout == NULL || num_reports <= 0 || column_stride < num_reports ){
+    return -1;
+  }
+  if ( devdesc->number_of_reports > 1 ){
+    for ( i = 0; i < num_reports; i++ ){
+      if ( reports[ (size_t) i * report_stride ] != reportid ){
+	return -1;
+      }
     }
+    data++;
+    report_size--;
+  }
+  if ( report_size * 8 < layout->report_bits ){
+    return -1; // short reports
   }
-  
-  size_t buflength = devd->report_lengths[ index ] / 8;
-  #ifdef DEBUG_PARSER
-    printf("report id %i, buflength %i\t", reportid, buflength );
-#endif    
 
-  if ( reportid != 0 ){
-      buflength++; // one more byte if report id is not 0
+  hid_values_write_begin( devdesc );
+  for ( i = 0; i < layout->num_fields; i++ ){
+    const struct hid_report_field * field = &devdesc->fields[ layout->first_field + i ];
+    int * column = columns + (size_t) i * column_stride;
+    hid_decode_field_column( data, report_size, report_stride, num_reports, field, column );
+    hid_store_value( devdesc, field->element_index, column[ num_reports - 1 ] );
+  }
+  hid_values_write_end( devdesc );
+  if ( timestamp_column != NULL ){
+    if ( timestamps != NULL ){
+      memcpy( timestamp_column, timestamps, sizeof( unsigned long long ) * num_reports );
+    } else {
+      unsigned long long now = hid_timestamp_now();
+      for ( i = 0; i < num_reports; i++ ){
+	timestamp_column[i] = now;
+      }
+    }
   }
-  buf = (char *) malloc( sizeof( char ) * buflength );
-  memset(buf, 0x0, sizeof(buf));
+  return layout->num_fields;
+}
 
-  // iterate over elements, find which ones are output elements with the right report id,
-  // and set their output values to the buffer
-  
-  int next_byte_size;
-  int next_mod_bit_size;
-  int byte_count = 0;
-  int next_val = 0;
+// set the value of an output or feature element and write it into its report, which is sent on the next commit
+int hid_set_output_value( struct hid_dev_desc * devd, struct hid_device_element * element, int value ){
+  struct hid_report_layout * layout;
+  int layout_index;
+  if ( element->io_type == 1 || element->field_index < 0 || element->buffer_size > 0 ){
+    return -1;
+  }
+  layout = hid_get_report_layout( devd, element->io_type, element->report_id );
+  if ( layout == NULL || layout->output_offset < 0 || layout->output_offset + 1 + ( layout->report_bits + 7 ) / 8 > devd->output_buffer_size ){
+    return -1;
+  }
+  hid_store_field( devd->output_buffer + layout->output_offset + 1, &devd->fields[ element->field_index ], value );
+  // the value is only kept once it is in the report that will be sent
+  hid_store_value( devd, element->index, value );
+  layout_index = (int) ( layout - devd->layouts );
+  if ( !devd->output_dirty[ layout_index ] ){
+    devd->output_dirty[ layout_index ] = 1;
+    devd->num_dirty++;
+  }
+  return 0;
+}
 
-  struct hid_device_collection * device_collection = devd->device_collection;
-  struct hid_device_element * cur_element = device_collection->first_element;
-  if ( cur_element->io_type != 2 || ( cur_element->report_id != reportid ) ){
-      cur_element = hid_get_next_output_element_with_reportid(cur_element, reportid);
+static void hid_clear_dirty( struct hid_dev_desc * devd, struct hid_report_layout * layout ){
+  int layout_index = (int) ( layout - devd->layouts );
+  if ( devd->output_dirty[ layout_index ] ){
+    devd->output_dirty[ layout_index ] = 0;
+    devd->num_dirty--;
   }
-  next_byte_size = cur_element->report_size/8;
-//   next_mod_bit_size = cur_element->report_size%8;
+}
 
+static int hid_write_output_layout( struct hid_dev_desc * devd, struct hid_report_layout * layout ){
+  int length = 1 + ( layout->report_bits + 7 ) / 8;
+  int res;
 #ifdef DEBUG_PARSER
-    printf("report_size %i, bytesize %i, bitsize %i \t", cur_element->report_size, next_byte_size, next_mod_bit_size );
-#endif    
-  
-#ifdef DEBUG_PARSER
-  printf("-----------------------\n");
+  printf("report id %i, length %i\n", layout->report_id, length );
 #endif
+  if ( layout->io_type == 3 ){
+    res = hid_send_feature_report( devd->device, devd->output_buffer + layout->output_offset, length );
+  } else {
+    res = hid_write( devd->device, devd->output_buffer + layout->output_offset, length );
+  }
+  if ( res >= 0 ){
+    hid_clear_dirty( devd, layout );
+  }
+  return res;
+}
 
-  for ( i = 0; i < buflength; i++){
-    unsigned char curbyte = 0;
-    if ( cur_element->report_size == 8 ){
-      curbyte = (unsigned char) cur_element->value;
-#ifdef DEBUG_PARSER
-	printf("element page %i, usage %i, index %i, value %i, report_size %i, curbyte %i\n", cur_element->usage_page, cur_element->usage, cur_element->index, cur_element->value, cur_element->report_size, curbyte );
-#endif      
-      cur_element = hid_get_next_output_element_with_reportid( cur_element, reportid );
-      next_byte_size = cur_element->report_size/8;     
-    } else if ( cur_element->report_size == 16 ){
-      int shift = byte_count*8;
-      curbyte = (unsigned char) (cur_element->value >> shift);
-      byte_count++;
-#ifdef DEBUG_PARSER
-	printf("element page %i, usage %i, index %i, value %i, report_size %i, curbyte %i\n", cur_element->usage_page, cur_element->usage, cur_element->index, cur_element->value, cur_element->report_size, curbyte );
-#endif      
-      if ( byte_count == next_byte_size ){
-	cur_element = hid_get_next_output_element_with_reportid( cur_element, reportid );
-	next_byte_size = cur_element->report_size/8;
+// copy bytes into an output or feature byte run, which is sent on the next commit
+int hid_set_output_buffer( struct hid_dev_desc * devd, struct hid_device_element * element, const unsigned char * data, int length ){
+  struct hid_report_layout * layout;
+  int layout_index;
+  if ( element->io_type == 1 || element->buffer_size <= 0 || element->buffer_offset < 0 ){
+    return -1;
+  }
+  layout = hid_get_report_layout( devd, element->io_type, element->report_id );
+  if ( layout == NULL ){
+    return -1;
+  }
+  if ( length > element->buffer_size ){
+    length = element->buffer_size;
+  }
+  memcpy( devd->output_buffer + layout->output_offset + 1 + element->buffer_offset, data, length );
+  layout_index = (int) ( layout - devd->layouts );
+  if ( !devd->output_dirty[ layout_index ] ){
+    devd->output_dirty[ layout_index ] = 1;
+    devd->num_dirty++;
+  }
+  return length;
+}
+
+// send every output and feature report that changed since it was last sent, each once;
+// returns the number of reports sent, or -1 if one failed (it stays dirty)
+int hid_commit_output_reports( struct hid_dev_desc * devd ){
+  int sent = 0;
+  int i;
+  for ( i = 0; i < devd->number_of_layouts && devd->num_dirty > 0; i++ ){
+    if ( devd->output_dirty[i] ){
+      if ( hid_write_output_layout( devd, &devd->layouts[i] ) < 0 ){
+	return -1;
       }
-    } else if ( cur_element->report_size < 8 ){
-      int bitindex = 0;
-      char curbits = 0;
-      // fill up the byte
-      while( bitindex < 8 ){
-	curbits = cur_element->value & BITMASK1( cur_element->report_size );
-	curbits = curbits << bitindex;
-	curbyte += curbits;
-	bitindex += cur_element->report_size;
-#ifdef DEBUG_PARSER
-	printf("element page %i, usage %i, index %i, value %i, report_size %i, curbyte %i\n", cur_element->usage_page, cur_element->usage, cur_element->index, cur_element->value, cur_element->report_size, curbyte );
-#endif      
-	cur_element = hid_get_next_output_element_with_reportid( cur_element, reportid );
-	next_byte_size = cur_element->report_size/8;
-// 	next_mod_bit_size = cur_element->report_size%8;	
-      }      
-    }
-    buf[ i ] = curbyte;
+      sent++;
+    }
   }
-#ifdef DEBUG_PARSER
-  printf("-----------------------\n");
-#endif
-  
+  return sent;
+}
 
-  int res = hid_write(devd->device, (const unsigned char*)buf, buflength);
+// send an output or feature report with the current values of its elements
+static int hid_send_report_values( struct hid_dev_desc * devd, int io_type, int reportid ){
+  struct hid_report_layout * layout = hid_get_report_layout( devd, io_type, reportid );
+  unsigned char * report;
+  int i;
+  if ( layout == NULL ){
+    return -1;
+  }
+  // the values may have been set directly with hid_element_set_rawvalue
+  report = devd->output_buffer + layout->output_offset + 1;
+  for ( i = 0; i < layout->num_fields; i++ ){
+    const struct hid_report_field * field = &devd->fields[ layout->first_field + i ];
+    if ( field->bit_size <= 32 ){
+      hid_store_field( report, field, devd->values[ field->element_index ] );
+    }
+  }
+  return hid_write_output_layout( devd, layout );
+}
 
-  free( buf );
-  return res;
+int hid_send_output_report( struct hid_dev_desc * devd, int reportid ){
+  return hid_send_report_values( devd, HID_REPORT_TYPE_OUTPUT, reportid );
+}
+
+int hid_send_feature_values( struct hid_dev_desc * devd, int reportid ){
+  return hid_send_report_values( devd, HID_REPORT_TYPE_FEATURE, reportid );
+}
+
+// get a feature report from the device and decode it into its elements; it is read into the
+// output buffer, so values set afterwards are sent on top of the current device state
+int hid_read_feature_report( struct hid_dev_desc * devd, int reportid ){
+  struct hid_report_layout * layout = hid_get_report_layout( devd, HID_REPORT_TYPE_FEATURE, reportid );
+  unsigned char * report;
+  int res;
+  if ( layout == NULL ){
+    return -1;
+  }
+  report = devd->output_buffer + layout->output_offset;
+  report[0] = (unsigned char) reportid;
+  res = hid_get_feature_report( devd->device, report, 1 + ( layout->report_bits + 7 ) / 8 );
+  report[0] = (unsigned char) reportid;
+  if ( res < 1 ){
+    return -1;
+  }
+  hid_clear_dirty( devd, layout ); // pending changes to this report are replaced
+  return hid_parse_feature_report( report, res, devd );
 }
 
 
@@ -957,8 +2912,14 @@ struct hid_dev_desc * hid_read_descriptor( hid_device * devd ){
     printf("Unable to read report descriptor\n");
     return NULL;
   } else {
-    desc = (struct hid_dev_desc *) malloc( sizeof( struct hid_dev_desc ) );
-    hid_parse_report_descriptor( descr_buf, res, desc );
+    desc = (struct hid_dev_desc *) calloc( 1, sizeof( struct hid_dev_desc ) );
+    if ( desc == NULL ){
+      return NULL;
+    }
+    if ( hid_parse_report_descriptor( (char *) descr_buf, res, desc ) != 0 ){
+      free( desc );
+      return NULL;
+    }
     return desc;
   }
 }
@@ -987,9 +2948,13 @@ struct hid_dev_desc * hid_open_device(  unsigned short vendor, unsigned short pr
 void hid_close_device( struct hid_dev_desc * devdesc ){
   hid_close( devdesc->device );
   hid_free_enumeration( devdesc->info );
-  hid_free_collection( devdesc->device_collection );
-  free( devdesc->report_ids );
-  free( devdesc->report_lengths );  
-//   hid_free_descriptor( devdesc->descriptor );
-  //TODO: more memory freeing?  
+  hid_release_descriptor( devdesc->descriptor );
+  free( devdesc->report_buffer );
+  free( devdesc->subscribed_fields );
+  if ( devdesc->conditioning != NULL ){
+    free( devdesc->conditioning->luts );
+    free( devdesc->conditioning );
+  }
+  free( devdesc->values ); // also holds the change set
+  free( devdesc );
 }
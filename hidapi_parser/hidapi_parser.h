@@ -28,6 +28,9 @@
 
 #define HIDAPI_MAX_DESCRIPTOR_SIZE  4096
 
+// number of report ids in the dispatch table (report ids are a single byte)
+#define HID_REPORT_DISPATCH_SIZE  256
+
 #ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
 extern "C" {
 #endif
@@ -40,15 +43,29 @@ extern "C" {
 
 struct hid_device_element;
 struct hid_device_collection;
-// struct hid_device_descriptor;
+struct hid_device_descriptor;
 struct hid_dev_desc;
+struct hid_report_field;
+struct hid_report_layout;
+struct hid_element_change;
+struct hid_usage_set;
+struct hid_conditioning;
 
 // struct hid_element_cb;
 // struct hid_descriptor_cb;
 
-typedef void (*hid_element_callback) ( struct hid_device_element *element, void *user_data);
+/** called for each element a report updated, with its new value */
+typedef void (*hid_element_callback) ( const struct hid_device_element *element, int value, void *user_data);
 // typedef void (*hid_descriptor_callback) ( struct hid_device_descriptor *descriptor, void *user_data);
 typedef void (*hid_descriptor_callback) ( struct hid_dev_desc *descriptor, void *user_data);
+/** called once per decoded report, with the elements it updated; the timestamp is in nanoseconds on a monotonic clock */
+typedef void (*hid_report_callback) ( struct hid_dev_desc *descriptor, int report_id, unsigned long long timestamp, const struct hid_element_change *changes, int num_changes, void *user_data);
+/** called when usages of an array field were pressed or released; bit n of the sets is usage usage_min + n */
+typedef void (*hid_usage_callback) ( struct hid_dev_desc *descriptor, const struct hid_usage_set *set, const unsigned long long *pressed, const unsigned long long *released, void *user_data);
+
+/** decoder generated by hidparsergen for one descriptor: writes the values of the fields of an
+ *  input report in layout order, returns the number of fields or -1 for an unknown or short report */
+typedef int (*hid_report_decoder) ( const unsigned char *data, int size, int report_id, int *values );
 
 // typedef struct _hid_element_cb {
 //     hid_element_callback cb;    
@@ -63,7 +80,8 @@ typedef void (*hid_descriptor_callback) ( struct hid_dev_desc *descriptor, void
 struct hid_dev_desc {
     int index;
     hid_device *device;
-//     struct hid_device_descriptor *descriptor;
+    /** the parsed descriptor, the pointers below point into it */
+    struct hid_device_descriptor *descriptor;
     struct hid_device_collection *device_collection;
     struct hid_device_info *info;
     
@@ -71,11 +89,83 @@ struct hid_dev_desc {
     int * report_lengths;
     int * report_ids;
 
+    /** compiled bit layouts, one per report id and io type */
+    int number_of_layouts;
+    struct hid_report_layout * layouts;
+    int number_of_fields;
+    struct hid_report_field * fields;
+    /** layout index by io type and report id, -1 if there is none */
+    short * report_dispatch;
+
+    /** elements and collections by index; both are the shared tables of the descriptor and are only read */
+    struct hid_device_element * elements;
+    struct hid_device_collection * collections;
+
+    /** current value of each element, by element index; written by the thread that decodes
+     *  reports, other threads read them with hid_snapshot_values */
+    int * values;
+    /** odd while the values of a report are written, grows by 2 with each report */
+    unsigned int values_sequence;
+
+    /** one copy of each report, at the report_offset of its layout, and per layout whether
+     *  the copy holds a report decoded since changes_only was turned on */
+    int report_buffer_size;
+    unsigned char * report_buffer;
+    unsigned char * report_seen;
+
+    /** only call back for elements whose value changed */
+    int changes_only;
+
     /** pointers to callback function */
     hid_element_callback _element_callback;
     void *_element_data;
     hid_descriptor_callback _descriptor_callback;
     void *_descriptor_data;
+    hid_report_callback _report_callback;
+    void *_report_data;
+
+    /** change set passed to the report callback */
+    struct hid_element_change * changes;
+
+    /** output and feature reports as they are sent, each with its report id byte in front,
+     *  at the output_offset of its layout; a layout is dirty when a value changed since it was sent */
+    int output_buffer_size;
+    unsigned char * output_buffer;
+    unsigned char * output_dirty;
+    int num_dirty;
+
+    /** pressed usages of the array fields, a bitset per usage set at its state_offset */
+    int number_of_usage_sets;
+    struct hid_usage_set * usage_sets;
+    unsigned long long * usage_state;
+    unsigned long long * usage_next;
+    unsigned long long * usage_pressed;
+    unsigned long long * usage_released;
+    /** per usage set, while decoding a report: whether its fields were decoded, or reported rollover */
+    unsigned char * usage_update;
+    hid_usage_callback _usage_callback;
+    void *_usage_data;
+
+    /** pruned copy of the fields when only some usages are subscribed, NULL for all fields;
+     *  the ranges hold the first field and number of fields per layout */
+    struct hid_report_field * subscribed_fields;
+    int * subscribed_ranges;
+
+    /** per layout, the data of the last report decoded with it */
+    const unsigned char ** report_data;
+
+    /** runs of 1 bit fields, with their bits as last decoded at the state_offset of each run */
+    int number_of_bit_runs;
+    struct hid_bit_run * bit_runs;
+    unsigned long long * bit_state;
+
+    /** generated decoder registered for this descriptor, NULL for the generic decoding,
+     *  with room for the values of the fields of one report */
+    hid_report_decoder _decoder;
+    int * decoded_values;
+
+    /** optional conditioning of the input values, NULL until it is set up */
+    struct hid_conditioning * conditioning;
 };
 
 struct hid_device_element {
@@ -99,14 +189,27 @@ struct hid_device_element {
 	int report_size;
 	int report_id;
 	int report_index; // index into the report
-
-	int value;
-
-	/** Pointer to the next element */
-	struct hid_device_element *next;
+	int field_index;  // index of the compiled field, -1 if the element has none
+	int usage_min;    // usage range of the item, -1 if it had none
+	int usage_max;
+	int next_of_type; // index of the next element with the same io type, -1 for the last one
+
+	/** vendor byte run: number of bytes and their byte offset in the report (-1 if not byte aligned);
+	 *  buffer_size is 0 for elements with a plain value. The value of a byte run is its length */
+	int buffer_size;
+	int buffer_offset;
+
+	/** precomputed mapping, value * scale + offset: logical range to 0..1, and to physical units */
+	float logical_scale;
+	float logical_offset;
+	float physical_scale;
+	float physical_offset;
+
+	/** Index of the next element, -1 for the last one */
+	int next;
 	
-	/** Pointer to the parent collection */
-	struct hid_device_collection *parent_collection;
+	/** Index of the parent collection */
+	int parent_collection;
 	
 };
 
@@ -119,73 +222,239 @@ struct hid_device_collection {
 	int num_elements;
 	int num_collections;
 
-	/** Pointer to the parent collection */
-	struct hid_device_collection *parent_collection;
+	/** Index of the parent collection, -1 for the device collection */
+	int parent_collection;
 
-	/** Pointer to the next collection */
-	struct hid_device_collection *next_collection;
+	/** Index of the next collection, -1 for none */
+	int next_collection;
 
-	/** Pointer to the first subcollection */
-	struct hid_device_collection *first_collection;  
+	/** Index of the first subcollection, -1 for none */
+	int first_collection;
 
-	/** Pointer to the first element */
-	struct hid_device_element *first_element;  
+	/** Index of the first element, -1 for none */
+	int first_element;
 };
 
-// struct hid_device_descriptor {
-// 	int num_elements;
-// 	int num_collections;
-// 
-// 
-// 	/** Pointer to the first collection */
-// 	struct hid_device_collection *first_collection;
-// 	/** Pointer to the first element */
-// 	struct hid_device_element *first;
-// 
-// 		/** pointers to callback function */
-// 	hid_element_callback _element_callback;
-// 	void *_element_data;
-// 	hid_descriptor_callback _descriptor_callback;
-// 	void *_descriptor_data;
-// };
+/** one field of a compiled report layout */
+struct hid_report_field {
+	int bit_offset;    // offset into the report data in bits (after the report id byte)
+	int bit_size;      // 1 to 32 bits
+	int is_signed;     // sign extend the raw value (logical_min < 0)
+	int element_index; // index of the element the value is stored in
+	int usage_set;     // array fields: index of the usage set, -1 for variables
+	int bit_run;       // first field of a run of 1 bit fields: index of the run, -1 otherwise
+};
+
+/** adjacent 1 bit fields of a report, decoded together as a bit mask */
+struct hid_bit_run {
+	int index;
+	int bit_offset;
+	int num_bits;
+	int first_field;
+	int state_offset; // offset into the bit state of the device, in 64 bit words
+};
+
+/** conditioning of input values after each report: the value is mapped to 0..1 (or looked up in
+ *  a calibration table), a deadzone around the center is cut out, and it is smoothed with a one
+ *  pole filter, y += alpha * ( x - y ). All arrays are by field index */
+struct hid_conditioning {
+	int number_of_fields;
+	float * center;
+	float * deadzone;
+	float * gain;     // rescales what is left outside the deadzone to the full range again
+	float * alpha;    // 1 for no smoothing
+	float * input;    // mapped values of the last report, before the deadzone and smoothing
+	float * output;   // the conditioned values
+
+	/** calibration tables of 0..1 values by raw value - lut_base, lut_offset is -1 for none */
+	int * lut_offset;
+	int * lut_base;
+	int * lut_last;
+	int number_of_luts;
+	int luts_size;
+	float * luts;
+
+	/** per layout, whether the smoothing has a previous value yet */
+	unsigned char * primed;
+};
+
+/** the compiled fields of one report */
+struct hid_report_layout {
+	int report_id;
+	int io_type;     // input(1), output(2), feature(3)
+	int report_bits; // length of the report data in bits
+	int first_field; // index into the fields of the device
+	int num_fields;
+	int report_offset; // byte offset into the report buffer of the device
+	int output_offset; // byte offset into the output buffer of the device, output and feature reports only
+	int first_usage_set;
+	int num_usage_sets;
+};
+
+/** the usages pressed in the array fields of one report and collection (e.g. the keys of a keyboard) */
+struct hid_usage_set {
+	int index;
+	int collection_index;
+	int report_id;
+	int io_type;
+	int usage_page;
+	int usage_min;
+	int usage_max;
+	int state_offset; // offset into the usage state of the device, in 64 bit words
+	int num_words;
+};
+
+/** new raw value of an element, as passed to the report callback */
+struct hid_element_change {
+	int index; // element index
+	int value;
+};
+
+/** a usage to subscribe to */
+struct hid_usage_id {
+	int usage_page;
+	int usage;
+};
+
+/** entry of the hash from usage to element */
+struct hid_element_key {
+	int usage_page;
+	int usage;
+	int occurrence;    // 0 for the first element with this usage
+	int element_index; // -1 for an empty slot
+};
+
+/** a parsed report descriptor, stored in one block of memory;
+ *  the tables follow the header at the given offsets and refer to each other by index.
+ *  Devices with the same report descriptor share one, so it is never written after parsing */
+struct hid_device_descriptor {
+	int size; // size of the whole block in bytes
+	unsigned int hash; // hash of the raw report descriptor
+	int raw_offset; // the raw report descriptor
+	int raw_size;
+
+	int num_elements;
+	int num_collections; // including the device collection
+	int number_of_reports;
+	int number_of_layouts;
+	int number_of_fields;
+	int report_buffer_size;
+	int output_buffer_size;
+
+	/** byte offsets of the tables from the start of the block */
+	int elements_offset;
+	int collections_offset;
+	int report_ids_offset;
+	int report_lengths_offset;
+	int layouts_offset;
+	int fields_offset;
+	int dispatch_offset;
+	int map_offset;         // logical and physical scale and offset per field, as floats, each map_stride long
+	int map_stride;
+	int value_index_offset; // per field, where its value is in the element table, in ints
+	int usage_sets_offset;
+	int number_of_usage_sets;
+	int usage_state_words;
+	int max_usage_set_words;
+	int element_keys_offset; // hash table from usage to element
+	int element_keys_size;   // a power of two
+	int io_elements_offset;  // element indices grouped by io type
+	int io_first[3];
+	int io_count[3];
+	int bit_runs_offset;
+	int number_of_bit_runs;
+	int bit_state_words;
+};
 
 // higher level functions:
 struct hid_dev_desc * hid_read_descriptor( hid_device *devd );
 struct hid_dev_desc * hid_open_device(  unsigned short vendor, unsigned short product, const wchar_t *serial_number );
 extern void hid_close_device( struct hid_dev_desc * devdesc );
 
-// struct hid_device_descriptor * hid_new_descriptor();
-// void hid_free_descriptor( struct hid_device_descriptor * devd);
-// void hid_free_device_descriptor( struct hid_dev_desc * devd);
-struct hid_device_collection * hid_new_collection();
-void hid_free_collection( struct hid_device_collection * coll );
-struct hid_device_element * hid_new_element();
-void hid_free_element( struct hid_device_element * ele);
+unsigned int hid_descriptor_hash( const unsigned char * descr_buf, int size );
+
+/** optional on-disk cache of parsed descriptors: loading maps the file and its descriptors are
+ *  used instead of parsing, saving writes all descriptors currently known. Both return the number
+ *  of descriptors or -1. Unloading fails while an open device uses a descriptor from the file */
+int hid_load_descriptor_cache( const char * path );
+int hid_save_descriptor_cache( const char * path );
+int hid_unload_descriptor_cache( void );
+
+/** use a generated decoder for devices with exactly this report descriptor, as in the generated
+ *  header; the bytes are kept, not copied. Applies to devices opened afterwards. Returns 0, or -1
+ *  when the registry is full */
+int hid_register_decoder( const unsigned char * descriptor, int descriptor_size, hid_report_decoder decoder );
 
 // void hid_descriptor_init( struct hid_device_descriptor * devd);
 
 void hid_set_descriptor_callback(  struct hid_dev_desc * devd, hid_descriptor_callback cb, void *user_data );
 void hid_set_element_callback(  struct hid_dev_desc * devd, hid_element_callback cb, void *user_data );
+void hid_set_report_callback(  struct hid_dev_desc * devd, hid_report_callback cb, void *user_data );
+void hid_set_usage_callback(  struct hid_dev_desc * devd, hid_usage_callback cb, void *user_data );
+int hid_set_changes_only(  struct hid_dev_desc * devd, int changes_only );
+int hid_subscribe_usages( struct hid_dev_desc * devd, const struct hid_usage_id * usages, int num_usages );
 
 int hid_parse_report_descriptor( char* descr_buf, int size, struct hid_dev_desc * device_desc );
 
+struct hid_device_element * hid_get_element( struct hid_dev_desc * devdesc, int index );
+int hid_get_element_value( struct hid_dev_desc * devdesc, int index );
+
+/** consistent copies of the element values for other threads than the decoding one: the values
+ *  of the given elements (elements 0 to count-1 when indices is NULL), or of all fields of a report
+ *  in layout order, as they were between two reports. They do not block the decoder, but retry
+ *  while it writes, which includes the element callbacks of a report. They return the sequence
+ *  of the snapshot, the same sequence means the same values */
+unsigned int hid_get_values_sequence( struct hid_dev_desc * devdesc );
+unsigned int hid_snapshot_values( struct hid_dev_desc * devdesc, const int * indices, int count, int * values );
+unsigned int hid_snapshot_report_values( struct hid_dev_desc * devdesc, struct hid_report_layout * layout, int * values );
+struct hid_device_element * hid_find_element_by_usage( struct hid_dev_desc * devdesc, int usage_page, int usage, int occurrence );
+const int * hid_get_io_elements( struct hid_dev_desc * devdesc, int io_type, int * count );
+const unsigned char * hid_get_element_buffer( struct hid_dev_desc * devdesc, struct hid_device_element * element, int * length );
+
 struct hid_device_element * hid_get_next_input_element( struct hid_device_element * curel );
 struct hid_device_element * hid_get_next_output_element( struct hid_device_element * curel );
 struct hid_device_element * hid_get_next_output_element_with_reportid( struct hid_device_element * curel, int reportid );
 struct hid_device_element * hid_get_next_feature_element( struct hid_device_element * curel );
 
+struct hid_report_layout * hid_get_report_layout( struct hid_dev_desc * devdesc, int io_type, int reportid );
+
 int hid_parse_input_report( unsigned char* buf, int size, struct hid_dev_desc * devdesc );
+int hid_parse_input_report_timed( unsigned char* buf, int size, struct hid_dev_desc * devdesc, unsigned long long timestamp );
+int hid_decode_report_batch( struct hid_dev_desc * devdesc, int reportid, const unsigned char * reports, int report_size, int report_stride, int num_reports, const unsigned long long * timestamps, int * columns, int column_stride, unsigned long long * timestamp_column );
+
+unsigned long long hid_timestamp_now( void );
+
+const unsigned long long * hid_get_bit_run_state( struct hid_dev_desc * devdesc, int run_index );
+void hid_unpack_bits( const unsigned long long * bits, int num_bits, unsigned char * out );
+
+int hid_usage_is_pressed( struct hid_dev_desc * devdesc, int set_index, int usage );
+const unsigned long long * hid_get_pressed_usages( struct hid_dev_desc * devdesc, int set_index );
+
+float hid_element_resolution( const struct hid_device_element * element );
+float hid_element_map_logical( const struct hid_device_element * element, int value );
+float hid_element_map_physical( const struct hid_device_element * element, int value );
+int hid_map_report_values( struct hid_dev_desc * devdesc, struct hid_report_layout * layout, float * out, int physical );
 
-float hid_element_resolution( struct hid_device_element * element );
-float hid_element_map_logical( struct hid_device_element * element );
-float hid_element_map_physical( struct hid_device_element * element );
+/** conditioning of input elements, set up on first use; the conditioned values are updated after
+ *  the element callbacks of a report and before its report callback. Deadzone and center are in
+ *  the 0..1 range of the element, a calibration table has an entry per logical value (at most 4096) */
+int hid_set_deadzone( struct hid_dev_desc * devd, struct hid_device_element * element, float deadzone, float center );
+int hid_set_smoothing( struct hid_dev_desc * devd, struct hid_device_element * element, float alpha );
+int hid_set_calibration( struct hid_dev_desc * devd, struct hid_device_element * element, const float * table, int size );
+float hid_get_conditioned_value( struct hid_dev_desc * devd, struct hid_device_element * element );
+const float * hid_get_conditioned_values( struct hid_dev_desc * devd, struct hid_report_layout * layout );
 
-void hid_element_set_rawvalue( struct hid_device_element * element, int value );
-void hid_element_set_logicalvalue( struct hid_device_element * element, float value );
+void hid_element_set_rawvalue( struct hid_dev_desc * devd, struct hid_device_element * element, int value );
+void hid_element_set_logicalvalue( struct hid_dev_desc * devd, struct hid_device_element * element, float value );
 
+int hid_set_output_value( struct hid_dev_desc * devd, struct hid_device_element * element, int value );
+int hid_set_output_buffer( struct hid_dev_desc * devd, struct hid_device_element * element, const unsigned char * data, int length );
+int hid_commit_output_reports( struct hid_dev_desc * devd );
 int hid_send_output_report( struct hid_dev_desc * devd, int reportid );
 
-// int hid_parse_feature_report( char* buf, int size, hid_device_descriptor * descriptor );
+int hid_parse_feature_report( unsigned char* buf, int size, struct hid_dev_desc * devdesc );
+int hid_read_feature_report( struct hid_dev_desc * devd, int reportid );
+int hid_send_feature_values( struct hid_dev_desc * devd, int reportid );
 
 #ifdef __cplusplus /* If this is a C++ compiler, end C linkage */
 }
@@ -85,10 +85,10 @@ void print_device_info( hid_device *handle ){
 	printf("Indexed String 1: %ls\n", wstr);
 }
 
-static void my_element_cb(const struct hid_device_element *el, void *data)
+static void my_element_cb(const struct hid_device_element *el, int value, void *data)
 {
     printf("in %s\t", __func__);
-    printf("element: usage %i, value %i, index %i\t", el->usage, el->value, el->index );
+    printf("element: usage %i, value %i, index %i\t", el->usage, value, el->index );
     printf("user_data: %s\n", (const char *)data);
 }
 
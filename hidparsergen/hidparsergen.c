@@ -0,0 +1,212 @@
+/* hidapi_parser $
+ *
+ * Copyright (C) 2013, Marije Baalman <nescivi _at_ gmail.com>
+ * This work was funded by a crowd-funding initiative for SuperCollider's [1] HID implementation
+ * including a substantial donation from BEK, Bergen Center for Electronic Arts, Norway
+ *
+ * [1] http://supercollider.sourceforge.net
+ * [2] http://www.bek.no
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+// hidparsergen: turns the report descriptor of a known device into a C header with an
+// unrolled decoder for its input reports. The descriptor is the raw blob, e.g. as found in
+// /sys/class/hidraw/hidraw0/device/report_descriptor
+//
+//   hidparsergen <descriptor file> <name> [<header file>]
+//
+// Including the header and calling <name>_register() makes the parser use the generated
+// decoder for devices with exactly this descriptor.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <hidapi.h>
+#include "hidapi_parser.h"
+
+#define MAX_DESCRIPTOR_SIZE 4096
+
+static int valid_name( const char * name ){
+  int i;
+  if ( !isalpha( (unsigned char) name[0] ) && name[0] != '_' ){
+    return 0;
+  }
+  for ( i = 1; name[i] != 0; i++ ){
+    if ( !isalnum( (unsigned char) name[i] ) && name[i] != '_' ){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// the value of one field as an expression on the report data: load the bytes it spans,
+// then shift and mask, or shift up and back down to sign extend
+static void print_field_value( FILE * out, const struct hid_report_field * field ){
+  int byte_offset = field->bit_offset >> 3;
+  int shift = field->bit_offset & 7;
+  int num_bytes = ( shift + field->bit_size + 7 ) >> 3;
+  int i;
+
+  if ( field->bit_size > 32 ){
+    fprintf( out, "%i", field->bit_size >> 3 ); // byte run: the value is its length
+    return;
+  }
+  fprintf( out, "(int) ( " );
+  if ( field->is_signed ){
+    fprintf( out, "(long long) ( " );
+  }
+  fprintf( out, "( " );
+  for ( i = 0; i < num_bytes; i++ ){
+    if ( i > 0 ){
+      fprintf( out, " | " );
+    }
+    if ( i == 0 ){
+      fprintf( out, "(unsigned long long) data[%i]", byte_offset );
+    } else {
+      fprintf( out, "(unsigned long long) data[%i] << %i", byte_offset + i, 8*i );
+    }
+  }
+  fprintf( out, " )" );
+  if ( field->is_signed ){
+    fprintf( out, " << %i ) >> %i )", 64 - shift - field->bit_size, 64 - field->bit_size );
+  } else {
+    fprintf( out, " >> %i & 0x%llxULL )", shift, ( 1ULL << field->bit_size ) - 1 );
+  }
+}
+
+static void print_field_comment( FILE * out, struct hid_dev_desc * devdesc, const struct hid_report_field * field ){
+  const struct hid_device_element * element = &devdesc->elements[ field->element_index ];
+  fprintf( out, " // element %i: usage page 0x%04x, usage 0x%04x, %i bits at bit %i%s\n",
+	   field->element_index, element->usage_page, element->usage, field->bit_size, field->bit_offset,
+	   field->is_signed ? ", signed" : "" );
+}
+
+static void generate_header( FILE * out, struct hid_dev_desc * devdesc, const char * name, const char * source ){
+  const unsigned char * raw;
+  int i, j;
+
+  fprintf( out, "// generated by hidparsergen from %s, do not edit\n\n", source );
+  fprintf( out, "#ifndef %s_DECODER_H\n#define %s_DECODER_H\n\n", name, name );
+  fprintf( out, "#include \"hidapi_parser.h\"\n\n" );
+  fprintf( out, "#define %s_DESCRIPTOR_HASH 0x%08xU\n", name, devdesc->descriptor->hash );
+  fprintf( out, "#define %s_DESCRIPTOR_SIZE %i\n\n", name, devdesc->descriptor->raw_size );
+
+  // the descriptor itself, the decoder is only used for devices with exactly these bytes
+  raw = (const unsigned char *) devdesc->descriptor + devdesc->descriptor->raw_offset;
+  fprintf( out, "static const unsigned char %s_descriptor[ %s_DESCRIPTOR_SIZE ] = {", name, name );
+  for ( i = 0; i < devdesc->descriptor->raw_size; i++ ){
+    fprintf( out, "%s0x%02x", i == 0 ? "\n  " : ( i % 16 == 0 ? ",\n  " : ", " ), raw[i] );
+  }
+  fprintf( out, "\n};\n\n" );
+
+  // a struct and decode function per input report
+  for ( i = 0; i < devdesc->number_of_layouts; i++ ){
+    const struct hid_report_layout * layout = &devdesc->layouts[i];
+    const struct hid_report_field * fields = devdesc->fields + layout->first_field;
+    if ( layout->io_type != 1 ){
+      continue;
+    }
+    fprintf( out, "// input report %i: %i fields in %i bytes\n", layout->report_id, layout->num_fields, ( layout->report_bits + 7 ) / 8 );
+    fprintf( out, "struct %s_report_%i {\n", name, layout->report_id );
+    for ( j = 0; j < layout->num_fields; j++ ){
+      fprintf( out, "  int field_%i;", j );
+      print_field_comment( out, devdesc, &fields[j] );
+    }
+    fprintf( out, "};\n\n" );
+    fprintf( out, "static inline int %s_decode_report_%i( const unsigned char * data, int size, struct %s_report_%i * report ){\n", name, layout->report_id, name, layout->report_id );
+    fprintf( out, "  if ( size < %i ){\n    return -1;\n  }\n", ( layout->report_bits + 7 ) / 8 );
+    for ( j = 0; j < layout->num_fields; j++ ){
+      fprintf( out, "  report->field_%i = ", j );
+      print_field_value( out, &fields[j] );
+      fprintf( out, ";\n" );
+    }
+    fprintf( out, "  return %i;\n}\n\n", layout->num_fields );
+  }
+
+  // the decoder the parser calls, with the values in layout order
+  fprintf( out, "static inline int %s_decode( const unsigned char * data, int size, int report_id, int * values ){\n", name );
+  fprintf( out, "  switch ( report_id ){\n" );
+  for ( i = 0; i < devdesc->number_of_layouts; i++ ){
+    const struct hid_report_layout * layout = &devdesc->layouts[i];
+    const struct hid_report_field * fields = devdesc->fields + layout->first_field;
+    if ( layout->io_type != 1 ){
+      continue;
+    }
+    fprintf( out, "  case %i:\n", layout->report_id );
+    fprintf( out, "    if ( size < %i ){\n      return -1;\n    }\n", ( layout->report_bits + 7 ) / 8 );
+    for ( j = 0; j < layout->num_fields; j++ ){
+      fprintf( out, "    values[%i] = ", j );
+      print_field_value( out, &fields[j] );
+      fprintf( out, ";\n" );
+    }
+    fprintf( out, "    return %i;\n", layout->num_fields );
+  }
+  fprintf( out, "  }\n  return -1;\n}\n\n" );
+
+  fprintf( out, "static inline int %s_register( void ){\n", name );
+  fprintf( out, "  return hid_register_decoder( %s_descriptor, %s_DESCRIPTOR_SIZE, %s_decode );\n}\n\n", name, name, name );
+  fprintf( out, "#endif\n" );
+}
+
+int main(int argc, char* argv[]){
+  char descriptor[ MAX_DESCRIPTOR_SIZE ];
+  struct hid_dev_desc * devdesc;
+  FILE * in;
+  FILE * out = stdout;
+  int size;
+
+  if ( argc < 3 ){
+    fprintf( stderr, "usage: %s <descriptor file> <name> [<header file>]\n", argv[0] );
+    return 1;
+  }
+  if ( !valid_name( argv[2] ) ){
+    fprintf( stderr, "name %s is not a valid C identifier\n", argv[2] );
+    return 1;
+  }
+
+  in = fopen( argv[1], "rb" );
+  if ( in == NULL ){
+    fprintf( stderr, "unable to open %s\n", argv[1] );
+    return 1;
+  }
+  size = (int) fread( descriptor, 1, MAX_DESCRIPTOR_SIZE, in );
+  fclose( in );
+  if ( size <= 0 ){
+    fprintf( stderr, "no descriptor in %s\n", argv[1] );
+    return 1;
+  }
+
+  devdesc = (struct hid_dev_desc *) calloc( 1, sizeof( struct hid_dev_desc ) );
+  if ( hid_parse_report_descriptor( descriptor, size, devdesc ) != 0 ){
+    fprintf( stderr, "unable to parse the descriptor in %s\n", argv[1] );
+    return 1;
+  }
+
+  if ( argc > 3 ){
+    out = fopen( argv[3], "w" );
+    if ( out == NULL ){
+      fprintf( stderr, "unable to write %s\n", argv[3] );
+      return 1;
+    }
+  }
+  generate_header( out, devdesc, argv[2], argv[1] );
+  if ( out != stdout ){
+    fclose( out );
+  }
+  return 0;
+}
@@ -30,6 +30,7 @@
 
 #include <hidapi.h>
 #include "hidapi_parser.h"
+#include "hid_reactor.h"
 
 
 // Headers needed for sleeping.
@@ -76,32 +77,32 @@ void print_element_info( struct hid_device_element *element ){
 	  element->report_size, element->report_id, element->report_index );
 }
 
-void print_collection_info( struct hid_device_collection *collection ){
+void print_collection_info( struct hid_dev_desc *devdesc, struct hid_device_collection *collection ){
   int i;
   printf( "COLLECTION index: %i, usage_page: %i, usage: %i, num_elements: %i, num_collections: %i \n",
 	  collection->index, collection->usage_page, collection->usage_index, 
 	  collection->num_elements, collection->num_collections );
  
-  struct hid_device_collection * cur_collection = collection->first_collection;
+  int cur_collection = collection->first_collection;
   
   printf( "number of collections in collection: %i\n", collection->num_collections );
   for ( i=0; i<collection->num_collections; i++ ){
-    if ( cur_collection != NULL ){
-      printf("cur_collection %p\n", cur_collection );
-      print_collection_info( cur_collection );
-      cur_collection = cur_collection->next_collection;
+    if ( cur_collection != -1 ){
+      printf("cur_collection %i\n", cur_collection );
+      print_collection_info( devdesc, &devdesc->collections[ cur_collection ] );
+      cur_collection = devdesc->collections[ cur_collection ].next_collection;
     }
   }
 
   
-  struct hid_device_element * cur_element = collection->first_element;
+  int cur_element = collection->first_element;
   
   printf( "number of elements in collection: %i\n", collection->num_elements );
   for ( i=0; i<collection->num_elements; i++ ){
-    if ( cur_element != NULL ){
-      printf("cur_element %p\n", cur_element );
-      print_element_info( cur_element );
-      cur_element = cur_element->next;
+    if ( cur_element != -1 ){
+      printf("cur_element %i\n", cur_element );
+      print_element_info( &devdesc->elements[ cur_element ] );
+      cur_element = devdesc->elements[ cur_element ].next;
     }
   }
 }
@@ -139,13 +140,24 @@ void print_device_info( hid_device *handle ){
 	printf("Indexed String 1: %ls\n", wstr);
 }
 
-static void my_element_cb(const struct hid_device_element *el, void *data)
+static void my_element_cb(const struct hid_device_element *el, int value, void *data)
 {
     printf("in %s\t", __func__);
-    printf("element: usage %i, value %i, index %i\t", el->usage, el->value, el->index );
+    printf("element: usage %i, value %i, index %i\t", el->usage, value, el->index );
     printf("user_data: %s\n", (const char *)data);
 }
 
+// reads the reports the device has waiting
+static void my_ready_cb(hid_device *device, void *data)
+{
+    struct hid_dev_desc *devdesc = (struct hid_dev_desc *) data;
+    unsigned char buf[256];
+    int res;
+    while ( ( res = hid_read_timeout( device, buf, sizeof(buf), 0 ) ) > 0 ) {
+      hid_parse_input_report( buf, res, devdesc );
+    }
+}
+
 static void my_descriptor_cb(const struct hid_dev_desc *dd, void *data)
 {
     printf("in %s\t", __func__);
@@ -155,8 +167,6 @@ static void my_descriptor_cb(const struct hid_dev_desc *dd, void *data)
 
 int main(int argc, char* argv[]){
 
-  int res;
-  unsigned char buf[256];
   unsigned char descr_buf[HIDAPI_MAX_DESCRIPTOR_SIZE];
     
   struct hid_dev_desc *devdesc;
@@ -219,20 +229,20 @@ int main(int argc, char* argv[]){
   // Set the hid_read() function to be non-blocking.
 //   hid_set_nonblocking(handle, 1);
 
-  print_collection_info( devdesc->device_collection );
+  print_collection_info( devdesc, devdesc->device_collection );
   
   printf("press key to continue\n" );
   getchar();
 
-  struct hid_device_element * cur_element = devdesc->device_collection->first_element;
+  int cur_element = devdesc->device_collection->first_element;
   
   printf( "number of elements in device: %i\n", devdesc->device_collection->num_elements );
-  while (cur_element != NULL ) {
-    printf("cur_element %p\n", cur_element );
-    print_element_info( cur_element );
+  while (cur_element != -1 ) {
+    printf("cur_element %i\n", cur_element );
+    print_element_info( &devdesc->elements[ cur_element ] );
 //     printf("press key to continue\n" );
 //     getchar();
-    cur_element = cur_element->next;
+    cur_element = devdesc->elements[ cur_element ].next;
   }
   
   printf("press key to continue\n" );
@@ -240,7 +250,7 @@ int main(int argc, char* argv[]){
 
   char my_custom_data[40] = "Hello!";
   hid_set_descriptor_callback( devdesc, (hid_descriptor_callback) my_descriptor_cb, my_custom_data );
-  hid_set_element_callback( devdesc, (hid_element_callback) my_element_cb, my_custom_data );  
+  hid_set_element_callback( devdesc, my_element_cb, my_custom_data );  
   
 //   Request state (cmd 0x81). The first byte is the report number (0x1).
 //   buf[0] = 0x1;
@@ -249,22 +259,21 @@ int main(int argc, char* argv[]){
 //   if (res < 0)
 // 	  printf("Unable to write() (2)\n");
 
- 	// Read requested state. hid_read() has been set to be
-	// non-blocking by the call to hid_set_nonblocking() above.
-	// This loop demonstrates the non-blocking nature of hid_read().
-	res = 0;
+ 	// Wait for reports with the reactor, which calls my_ready_cb as soon as
+	// the device has one, instead of polling the device.
+	struct hid_reactor *reactor = hid_reactor_new();
+	if ( reactor == NULL || hid_reactor_add( reactor, devdesc->device, my_ready_cb, devdesc ) != 0 ) {
+		fprintf(stderr, "Unable to wait on the device\n");
+		return 1;
+	}
+	// read what is waiting already; on Windows this also starts the read that the reactor waits on
+	my_ready_cb( devdesc->device, devdesc );
 	while (1) {
-		res = hid_read(devdesc->device, buf, sizeof(buf));
-		if ( res > 0 ) {
-		  hid_parse_input_report( buf, res, devdesc );
-		}
-		#ifdef WIN32
-		Sleep(500);
-		#else
-		usleep(500*100);
-		#endif
+		if ( hid_reactor_wait( reactor, NULL, 0, -1 ) < 0 )
+			break;
 	}
 
+	hid_reactor_free( reactor );
 	hid_close_device( devdesc );
 // 	hid_close(handle);
 
@@ -45,6 +45,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "hidapi.h"
+#include "hid_reactor.h"
 
 // Headers needed for sleeping.
 #ifdef _WIN32
@@ -622,10 +623,26 @@ int main(int argc, char* argv[])
 
 	// Read requested state. hid_read() has been set to be
 	// non-blocking by the call to hid_set_nonblocking() above.
-	// This loop demonstrates the non-blocking nature of hid_read().
+	// The reactor waits until the device has a report, so that the
+	// non-blocking hid_read() does not have to be polled. It only waits when
+	// hid_read() found no report: on Windows that read stays pending, and
+	// the device only becomes ready while a read is pending.
+	struct hid_reactor *reactor = hid_reactor_new();
+	hid_device *ready;
+	if ( reactor == NULL || hid_reactor_add( reactor, handle, NULL, NULL ) != 0 ) {
+		printf("Unable to wait on the device\n");
+		return 1;
+	}
 	res = 0;
 	while (true) {
 		res = hid_read(handle, buf, sizeof(buf));
+		if ( res == 0 ) {
+			if ( hid_reactor_wait( reactor, &ready, 1, -1 ) < 0 )
+				break;
+			continue;
+		}
+		if ( res < 0 )
+			break;
 // 		if (res == 0)
 // 			printf("waiting...\n");
 // 		if (res < 0)
@@ -655,14 +672,9 @@ int main(int argc, char* argv[])
 		  }
 		  printf("\n");
 		}
-		#ifdef WIN32
-		Sleep(500);
-		#else
-		usleep(500*100);
-		#endif
 	}
 
-
+	hid_reactor_free( reactor );
 	hid_close(handle);
 
 	/* Free static HIDAPI objects. */
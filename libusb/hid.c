@@ -40,6 +40,7 @@
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
 #include <fcntl.h>
+#include <time.h>
 #include <pthread.h>
 #include <wchar.h>
 
@@ -78,6 +79,7 @@ instead to differentiate between interfaces on a composite HID device. */
 struct input_report {
 	struct input_report *next;
 	size_t len;
+	struct hid_report_info info; /* taken when the transfer completed */
 	uint8_t data[1];
 };
 
@@ -113,6 +115,7 @@ struct hid_device_ {
 
 	/* List of received input reports. */
 	int num_queued_reports;
+	unsigned int input_sequence; /* of the next report that arrives */
 	struct input_report *input_reports;
         struct input_report **last_input_report;
         int ichan[2];     /* thread write on 1 client poll on 0 */
@@ -122,9 +125,16 @@ struct hid_device_ {
 static libusb_context *usb_context = NULL;
 
 uint16_t get_usb_code_for_current_locale(void);
-static int return_data(hid_device *dev, unsigned char *data, size_t length);
+static int return_data(hid_device *dev, unsigned char *data, size_t length, struct hid_report_info *info);
 static int drop_data(hid_device *dev);
 
+static unsigned long long monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static hid_device *new_hid_device(void)
 {
 	hid_device *dev = calloc(1, sizeof(hid_device));
@@ -664,14 +674,20 @@ static void read_callback(struct libusb_transfer *transfer)
 	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
 
 	    struct input_report *rpt;
+		unsigned long long timestamp = monotonic_ns();
 		rpt = malloc(sizeof(struct input_report)+
 			     transfer->actual_length);
 		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
 		rpt->len = transfer->actual_length;
+		rpt->info.timestamp = timestamp;
 		rpt->next = NULL;
 
 		pthread_mutex_lock(&dev->mutex);
 
+		/* Numbered as it arrives, so that the reports
+		   dropped from a full queue leave a gap */
+		rpt->info.sequence = dev->input_sequence++;
+
 		*dev->last_input_report = rpt;
 		dev->last_input_report = &(rpt->next);
 		dev->num_queued_reports++;
@@ -994,7 +1010,7 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 
 /* Helper function, to simplify hid_read().
    This should be called with dev->mutex locked. */
-static int return_data(hid_device *dev, unsigned char *data, size_t length)
+static int return_data(hid_device *dev, unsigned char *data, size_t length, struct hid_report_info *info)
 {
 	/* Copy the data out of the linked list item (rpt) into the
 	   return buffer (data), and delete the liked list item. */
@@ -1004,6 +1020,8 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length)
 	    char buf[1];
 	    
 	    memcpy(data, rpt->data, len);
+	    if (info)
+		*info = rpt->info;
 	    if (read(dev->ichan[0], buf, 1) < 1)  /* clear event */
 		LOG("read failed %s\n", strerror(errno));
 	    dev->num_queued_reports--;
@@ -1036,7 +1054,7 @@ static void cleanup_mutex(void *param)
 }
 
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+int HID_API_EXPORT hid_read_timeout_ex(hid_device *dev, unsigned char *data, size_t length, int milliseconds, struct hid_report_info *info)
 {
 	int bytes_read = -1;
 
@@ -1053,7 +1071,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	/* There's an input report queued up. Return it. */
 	if (dev->input_reports) {
 		/* Return the first one */
-		bytes_read = return_data(dev, data, length);
+		bytes_read = return_data(dev, data, length, info);
 		goto ret;
 	}
 
@@ -1070,7 +1088,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			pthread_cond_wait(&dev->condition, &dev->mutex);
 		}
 		if (dev->input_reports) {
-			bytes_read = return_data(dev, data, length);
+			bytes_read = return_data(dev, data, length, info);
 		}
 	}
 	else if (milliseconds > 0) {
@@ -1089,7 +1107,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
 			if (res == 0) {
 				if (dev->input_reports) {
-					bytes_read = return_data(dev, data, length);
+					bytes_read = return_data(dev, data, length, info);
 					break;
 				}
 
@@ -1121,11 +1139,47 @@ ret:
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timeout_ex(dev, data, length, milliseconds, NULL);
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
 }
 
+int HID_API_EXPORT hid_read_ex(hid_device *dev, unsigned char *data, size_t length, struct hid_report_info *info)
+{
+	return hid_read_timeout_ex(dev, data, length, dev->blocking ? -1 : 0, info);
+}
+
+int HID_API_EXPORT hid_read_batch(hid_device *dev, struct hid_report_slot *slots, int num_slots, int milliseconds)
+{
+	int num_reports = 0;
+	int bytes_read;
+
+	if (num_slots <= 0)
+		return 0;
+
+	/* Wait for the first report as hid_read_timeout() does */
+	bytes_read = hid_read_timeout_ex(dev, slots[0].data, slots[0].length, milliseconds, &slots[0].info);
+	if (bytes_read <= 0)
+		return bytes_read;
+	slots[0].bytes_read = bytes_read;
+	num_reports = 1;
+
+	/* Then take the rest of the queue, under one lock */
+	pthread_mutex_lock(&dev->mutex);
+	while (num_reports < num_slots && dev->input_reports) {
+		slots[num_reports].bytes_read = return_data(dev, slots[num_reports].data, slots[num_reports].length, &slots[num_reports].info);
+		num_reports++;
+	}
+	pthread_mutex_unlock(&dev->mutex);
+
+	return num_reports;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -36,14 +36,30 @@
 #include <sys/utsname.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
 
 /* Linux */
 #include <linux/hidraw.h>
 #include <linux/version.h>
 #include <linux/input.h>
 #include <libudev.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+/* Headers before 5.6 have no IORING_OP_READ nor the probe, which came
+   with IO_URING_OP_SUPPORTED (IORING_REGISTER_PROBE is an enum) */
+#ifdef IO_URING_OP_SUPPORTED
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
 
 #include "hidapi.h"
+#include "hidapi_hidraw.h"
 
 /* Definitions from linux/hidraw.h. Since these are new, some distros
    may not have header files which contain them. */
@@ -75,6 +91,12 @@ struct hid_device_ {
 	int device_handle;
 	int blocking;
 	int uses_numbered_reports;
+	int nonblocking_fd; /* O_NONBLOCK is set on device_handle */
+	unsigned int sequence; /* of the next report that is read */
+	int fast_read; /* see hid_set_fast_read() */
+	int disconnected; /* seen by a fast read, or by the udev monitor */
+	dev_t devnum; /* to find the device in udev remove events */
+	hid_device *next_fast; /* in fast_read_devices */
 };
 
 
@@ -86,10 +108,171 @@ static hid_device *new_hid_device(void)
 	dev->device_handle = -1;
 	dev->blocking = 1;
 	dev->uses_numbered_reports = 0;
+	dev->nonblocking_fd = 0;
+	dev->sequence = 0;
 
 	return dev;
 }
 
+static unsigned long long monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long long monotonic_ms(void)
+{
+	return (long long) (monotonic_ns() / 1000000);
+}
+
+static int make_nonblocking(hid_device *dev)
+{
+	if (!dev->nonblocking_fd) {
+		int flags = fcntl(dev->device_handle, F_GETFL, 0);
+		if (flags == -1 || fcntl(dev->device_handle, F_SETFL, flags | O_NONBLOCK) == -1)
+			return -1;
+		dev->nonblocking_fd = 1;
+	}
+	return 0;
+}
+
+/* The devices in fast read mode, and the udev monitor they share to
+   learn about their removal. The lock is only held for short updates;
+   a reader that finds it taken just skips the monitor this time. */
+#define FAST_READ_MONITOR_MS 100 /* between looks at the monitor */
+
+static struct udev *fast_read_udev = NULL;
+static struct udev_monitor *fast_read_monitor = NULL;
+static hid_device *fast_read_devices = NULL;
+static long long fast_read_checked = 0;
+static int fast_read_lock = 0;
+
+static int fast_read_trylock(void)
+{
+	return !__atomic_exchange_n(&fast_read_lock, 1, __ATOMIC_ACQUIRE);
+}
+
+static void fast_read_unlock(void)
+{
+	__atomic_store_n(&fast_read_lock, 0, __ATOMIC_RELEASE);
+}
+
+static void fast_read_add(hid_device *dev)
+{
+	while (!fast_read_trylock())
+		sched_yield();
+
+	if (!fast_read_monitor) {
+		/* Without udev, ENODEV from read() is all there is */
+		fast_read_udev = udev_new();
+		if (fast_read_udev)
+			fast_read_monitor = udev_monitor_new_from_netlink(fast_read_udev, "udev");
+		if (fast_read_monitor &&
+		    (udev_monitor_filter_add_match_subsystem_devtype(fast_read_monitor, "hidraw", NULL) < 0 ||
+		     udev_monitor_enable_receiving(fast_read_monitor) < 0)) {
+			udev_monitor_unref(fast_read_monitor);
+			fast_read_monitor = NULL;
+		}
+	}
+	dev->next_fast = fast_read_devices;
+	fast_read_devices = dev;
+
+	fast_read_unlock();
+}
+
+static void fast_read_remove(hid_device *dev)
+{
+	hid_device **link;
+
+	while (!fast_read_trylock())
+		sched_yield();
+
+	for (link = &fast_read_devices; *link; link = &(*link)->next_fast) {
+		if (*link == dev) {
+			*link = dev->next_fast;
+			break;
+		}
+	}
+	if (!fast_read_devices) {
+		/* The last one, let the monitor go */
+		if (fast_read_monitor)
+			udev_monitor_unref(fast_read_monitor);
+		if (fast_read_udev)
+			udev_unref(fast_read_udev);
+		fast_read_monitor = NULL;
+		fast_read_udev = NULL;
+	}
+
+	fast_read_unlock();
+}
+
+/* Take the removals from the monitor, if it is time to look again */
+static void fast_read_check_monitor(void)
+{
+	long long now = monotonic_ms();
+	struct udev_device *udev_dev;
+
+	if (now - __atomic_load_n(&fast_read_checked, __ATOMIC_RELAXED) < FAST_READ_MONITOR_MS)
+		return;
+	if (!fast_read_trylock())
+		return;
+	__atomic_store_n(&fast_read_checked, now, __ATOMIC_RELAXED);
+
+	/* The monitor socket is non-blocking, this returns NULL once
+	   there are no more events */
+	while (fast_read_monitor &&
+	       (udev_dev = udev_monitor_receive_device(fast_read_monitor)) != NULL) {
+		const char *action = udev_device_get_action(udev_dev);
+		if (action && strcmp(action, "remove") == 0) {
+			dev_t devnum = udev_device_get_devnum(udev_dev);
+			hid_device *dev;
+			for (dev = fast_read_devices; dev; dev = dev->next_fast) {
+				if (dev->devnum == devnum)
+					__atomic_store_n(&dev->disconnected, 1, __ATOMIC_RELAXED);
+			}
+		}
+		udev_device_unref(udev_dev);
+	}
+
+	fast_read_unlock();
+}
+
+/* One read() of a device in fast read mode. Returns the number of
+   bytes read, 0 when there is no report and -1 when the device is gone. */
+static int fast_read(hid_device *dev, unsigned char *data, size_t length)
+{
+	int bytes_read;
+
+	if (__atomic_load_n(&dev->disconnected, __ATOMIC_RELAXED))
+		return -1;
+
+	bytes_read = read(dev->device_handle, data, length);
+	if (bytes_read >= 0)
+		return bytes_read;
+	if (errno != EAGAIN && errno != EINTR) {
+		/* ENODEV on kernels that report the disconnect */
+		__atomic_store_n(&dev->disconnected, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	/* Others keep returning EAGAIN for a device that is gone */
+	fast_read_check_monitor();
+	if (__atomic_load_n(&dev->disconnected, __ATOMIC_RELAXED))
+		return -1;
+	return 0;
+}
+
+/* Number a report that was read, and fill in its info if wanted */
+static void set_report_info(hid_device *dev, struct hid_report_info *info, unsigned long long timestamp)
+{
+	if (info) {
+		info->timestamp = timestamp;
+		info->sequence = dev->sequence;
+	}
+	dev->sequence++;
+}
+
 
 /* The caller must free the returned string with free(). */
 static wchar_t *utf8_to_wchar_t(const char *utf8)
@@ -697,17 +880,31 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 }
 
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+int HID_API_EXPORT hid_read_timeout_ex(hid_device *dev, unsigned char *data, size_t length, int milliseconds, struct hid_report_info *info)
 {
 	int bytes_read;
+	unsigned long long timestamp = 0;
+
+	if (dev->fast_read) {
+		/* Read first, and only poll when there is nothing yet
+		   and the call is to wait for it */
+		bytes_read = fast_read(dev, data, length);
+		if (bytes_read > 0) {
+			timestamp = monotonic_ns();
+			goto have_report;
+		}
+		if (bytes_read < 0 || milliseconds == 0)
+			return bytes_read;
+	}
 
-	if (milliseconds >= 0) {
+	if (milliseconds >= 0 || dev->nonblocking_fd) {
 		/* Milliseconds is either 0 (non-blocking) or > 0 (contains
 		   a valid timeout). In both cases we want to call poll()
 		   and wait for data to arrive.  Don't rely on non-blocking
 		   operation (O_NONBLOCK) since some kernels don't seem to
 		   properly report device disconnection through read() when
-		   in non-blocking mode.  */
+		   in non-blocking mode. Blocking reads wait in poll() too
+		   while the read engine has made the descriptor non-blocking. */
 		int ret;
 		struct pollfd fds;
 
@@ -724,6 +921,8 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			   indicate a device disconnection. */
 			if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
 				return -1;
+			/* The report arrived about now */
+			timestamp = monotonic_ns();
 		}
 	}
 
@@ -731,6 +930,10 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	if (bytes_read < 0 && (errno == EAGAIN || errno == EINPROGRESS))
 		bytes_read = 0;
 
+have_report:
+	if (bytes_read > 0)
+		set_report_info(dev, info, timestamp? timestamp: monotonic_ns());
+
 	if (bytes_read >= 0 &&
 	    kernel_version < KERNEL_VERSION(2,6,34) &&
 	    dev->uses_numbered_reports) {
@@ -742,11 +945,109 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timeout_ex(dev, data, length, milliseconds, NULL);
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT hid_read_ex(hid_device *dev, unsigned char *data, size_t length, struct hid_report_info *info)
+{
+	return hid_read_timeout_ex(dev, data, length, (dev->blocking)? -1: 0, info);
+}
+
+/* Read the reports that are queued already, into the slots. The
+   descriptor is non-blocking. Returns the number of slots used, or -1
+   when the first read fails. */
+static int read_queued(hid_device *dev, struct hid_report_slot *slots, int num_slots, unsigned long long timestamp)
+{
+	int num_reports = 0;
+
+	while (num_reports < num_slots) {
+		struct hid_report_slot *slot = &slots[num_reports];
+		int bytes_read;
+
+		if (dev->fast_read) {
+			bytes_read = fast_read(dev, slot->data, slot->length);
+			if (bytes_read == 0)
+				break;
+		}
+		else {
+			bytes_read = read(dev->device_handle, slot->data, slot->length);
+			if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR))
+				break;
+		}
+		if (bytes_read < 0) {
+			/* Return what was read, the error shows on the next call */
+			return (num_reports > 0)? num_reports: -1;
+		}
+
+		if (bytes_read > 0 &&
+		    kernel_version < KERNEL_VERSION(2,6,34) &&
+		    dev->uses_numbered_reports) {
+			/* Work around a kernel bug. Chop off the first byte. */
+			memmove(slot->data, slot->data+1, bytes_read);
+			bytes_read--;
+		}
+		slot->bytes_read = bytes_read;
+		if (bytes_read > 0)
+			set_report_info(dev, &slot->info, timestamp? timestamp: monotonic_ns());
+		else
+			memset(&slot->info, 0, sizeof(slot->info));
+		num_reports++;
+	}
+
+	return num_reports;
+}
+
+int HID_API_EXPORT hid_read_batch(hid_device *dev, struct hid_report_slot *slots, int num_slots, int milliseconds)
+{
+	int num_reports = 0;
+	int ret;
+	struct pollfd fds;
+	unsigned long long timestamp;
+
+	if (num_slots <= 0)
+		return 0;
+	if (__atomic_load_n(&dev->disconnected, __ATOMIC_RELAXED))
+		return -1;
+
+	/* In fast read mode read first, and only wait when there is nothing
+	   yet and the call is to wait for it, as hid_read_timeout() does */
+	if (dev->fast_read) {
+		num_reports = read_queued(dev, slots, num_slots, 0);
+		if (num_reports != 0 || milliseconds == 0)
+			return num_reports;
+	}
+
+	/* Wait once for the first report, as hid_read_timeout() does */
+	fds.fd = dev->device_handle;
+	fds.events = POLLIN;
+	fds.revents = 0;
+	ret = poll(&fds, 1, milliseconds);
+	if (ret == -1 || ret == 0) {
+		/* Error or timeout */
+		return ret;
+	}
+	if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
+		return -1;
+	/* Reports that were queued already get the time of the wakeup too */
+	timestamp = monotonic_ns();
+
+	/* Then read until the queue of the device is empty, which needs a
+	   non-blocking descriptor. It is set once and stays so: blocking
+	   reads wait in poll() as soon as nonblocking_fd is set. */
+	if (make_nonblocking(dev) < 0)
+		return -1;
+	num_reports = read_queued(dev, slots, num_slots, timestamp);
+
+	return num_reports;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	/* Do all non-blocking in userspace using poll(), since it looks
@@ -757,6 +1058,29 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 	return 0; /* Success */
 }
 
+int HID_API_EXPORT HID_API_CALL hid_set_fast_read(hid_device *dev, int enable)
+{
+	struct stat s;
+
+	if (!enable) {
+		if (dev->fast_read) {
+			fast_read_remove(dev);
+			dev->fast_read = 0;
+		}
+		return 0;
+	}
+	if (dev->fast_read)
+		return 0;
+
+	/* As if the node had been opened with O_NONBLOCK */
+	if (fstat(dev->device_handle, &s) == -1 || make_nonblocking(dev) == -1)
+		return -1;
+	dev->devnum = s.st_rdev;
+	fast_read_add(dev);
+	dev->fast_read = 1;
+	return 0;
+}
+
 // return an event handle that can be used for poll/epoll/select etc
 hid_handle_t HID_API_EXPORT hid_get_event_handle(hid_device *dev)
 {
@@ -792,6 +1116,8 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 {
 	if (!dev)
 		return;
+	if (dev->fast_read)
+		fast_read_remove(dev);
 	close(dev->device_handle);
 	free(dev);
 }
@@ -822,3 +1148,543 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 {
 	return NULL;
 }
+
+
+/* Read engine: one read in flight per device, in an io_uring when the
+   kernel has one that can read, cancel and time out, otherwise the
+   devices are read when epoll reports them readable. */
+
+struct engine_device {
+	hid_device *dev;
+	void *user_data;
+	unsigned char *buffer;
+	size_t length;
+	int in_flight; /* a read or poll of this device is in the ring */
+	int polling;   /* waiting for the device to be readable */
+	int removed;   /* freed when its read completes */
+	int failed;    /* disconnected, not read again */
+};
+
+struct hid_read_engine {
+	int uses_io_uring;
+	int max_devices;
+	int num_devices;
+	struct engine_device **devices;
+	/* devices whose reports were returned, read again on the next wait */
+	struct engine_device **delivered;
+	int num_delivered;
+	/* removed devices with a read still in flight */
+	int num_removed;
+
+	int epoll_fd;
+
+	int ring_fd;
+	unsigned to_submit;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	void *sqe_mem;
+	size_t sqe_mem_size;
+	unsigned *sq_tail;
+	unsigned *sq_head;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+#ifdef HAVE_IO_URING
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+#endif
+};
+
+static void free_engine_device(struct engine_device *entry)
+{
+	free(entry->buffer);
+	free(entry);
+}
+
+#ifdef HAVE_IO_URING
+
+static int ring_enter(struct hid_read_engine *engine, unsigned min_complete, unsigned flags)
+{
+	int res = syscall(__NR_io_uring_enter, engine->ring_fd, engine->to_submit, min_complete, flags, NULL, 0);
+	if (res >= 0)
+		engine->to_submit -= ((unsigned) res < engine->to_submit)? (unsigned) res: engine->to_submit;
+	return res;
+}
+
+/* A cleared submission entry, submitting what is queued when the ring is full */
+static struct io_uring_sqe *ring_get_sqe(struct hid_read_engine *engine)
+{
+	unsigned tail = *engine->sq_tail;
+	struct io_uring_sqe *sqe;
+	while (tail - __atomic_load_n(engine->sq_head, __ATOMIC_ACQUIRE) >= engine->sq_entries) {
+		if (ring_enter(engine, 0, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			return NULL;
+	}
+	sqe = &engine->sqes[tail & engine->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static void ring_push_sqe(struct hid_read_engine *engine)
+{
+	__atomic_store_n(engine->sq_tail, *engine->sq_tail + 1, __ATOMIC_RELEASE);
+	engine->to_submit++;
+}
+
+static int ring_queue_read(struct hid_read_engine *engine, struct engine_device *entry)
+{
+	struct io_uring_sqe *sqe = ring_get_sqe(engine);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = entry->dev->device_handle;
+	sqe->addr = (unsigned long) entry->buffer;
+	sqe->len = entry->length;
+	sqe->user_data = (unsigned long) entry;
+	ring_push_sqe(engine);
+	entry->in_flight = 1;
+	entry->polling = 0;
+	return 0;
+}
+
+/* A read of a non-blocking descriptor fails with -EAGAIN, rather than
+   waiting, on kernels before 5.11; wait for it to be readable first. */
+static int ring_queue_poll(struct hid_read_engine *engine, struct engine_device *entry)
+{
+	struct io_uring_sqe *sqe = ring_get_sqe(engine);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = entry->dev->device_handle;
+	sqe->poll_events = POLLIN;
+	sqe->user_data = (unsigned long) entry;
+	ring_push_sqe(engine);
+	entry->in_flight = 1;
+	entry->polling = 1;
+	return 0;
+}
+
+static int ring_queue_cancel(struct hid_read_engine *engine, struct engine_device *entry)
+{
+	struct io_uring_sqe *sqe = ring_get_sqe(engine);
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (unsigned long) entry;
+	sqe->user_data = 0; /* completions without a device are skipped */
+	ring_push_sqe(engine);
+	return 0;
+}
+
+/* Take the completed reads, as reports for the caller, up to max_completions */
+static int ring_reap(struct hid_read_engine *engine, struct hid_read_completion *completions, int max_completions)
+{
+	unsigned head = *engine->cq_head;
+	unsigned tail = __atomic_load_n(engine->cq_tail, __ATOMIC_ACQUIRE);
+	unsigned long long timestamp = monotonic_ns();
+	int n = 0;
+
+	while (head != tail && n < max_completions) {
+		struct io_uring_cqe *cqe = &engine->cqes[head & engine->cq_mask];
+		struct engine_device *entry = (struct engine_device *) (unsigned long) cqe->user_data;
+		int res = cqe->res;
+		head++;
+		if (!entry)
+			continue;
+		entry->in_flight = 0;
+		if (entry->removed) {
+			engine->num_removed--;
+			free_engine_device(entry);
+			continue;
+		}
+		if (res == -EINTR || (entry->polling && res >= 0)) {
+			ring_queue_read(engine, entry);
+			continue;
+		}
+		if (res == -EAGAIN) {
+			ring_queue_poll(engine, entry);
+			continue;
+		}
+		completions[n].device = entry->dev;
+		completions[n].user_data = entry->user_data;
+		completions[n].data = entry->buffer;
+		if (res < 0) {
+			/* The device is gone */
+			completions[n].bytes_read = -1;
+			memset(&completions[n].info, 0, sizeof(completions[n].info));
+			entry->failed = 1;
+		}
+		else {
+			completions[n].bytes_read = res;
+			if (res > 0)
+				set_report_info(entry->dev, &completions[n].info, timestamp);
+			else
+				memset(&completions[n].info, 0, sizeof(completions[n].info));
+			engine->delivered[engine->num_delivered++] = entry;
+		}
+		n++;
+	}
+	__atomic_store_n(engine->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+static int ring_wait(struct hid_read_engine *engine, struct hid_read_completion *completions, int max_completions, int milliseconds)
+{
+	long long deadline = monotonic_ms() + milliseconds;
+	int n;
+	int i;
+
+	/* The buffers of the last reports have been handed back, read again */
+	for (i = 0; i < engine->num_delivered; i++)
+		ring_queue_read(engine, engine->delivered[i]);
+	engine->num_delivered = 0;
+
+	n = ring_reap(engine, completions, max_completions);
+	while (n == 0) {
+		struct __kernel_timespec ts;
+		int res;
+		if (milliseconds > 0) {
+			long long left = deadline - monotonic_ms();
+			struct io_uring_sqe *sqe;
+			if (left <= 0)
+				break;
+			/* Wake up after the time left or at the next completion */
+			ts.tv_sec = left / 1000;
+			ts.tv_nsec = (left % 1000) * 1000000;
+			sqe = ring_get_sqe(engine);
+			if (!sqe)
+				return -1;
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->fd = -1;
+			sqe->addr = (unsigned long) &ts;
+			sqe->len = 1;
+			sqe->off = 1;
+			sqe->user_data = 0;
+			ring_push_sqe(engine);
+		}
+		res = ring_enter(engine, (milliseconds == 0)? 0: 1, (milliseconds == 0)? 0: IORING_ENTER_GETEVENTS);
+		if (res < 0 && errno != EINTR)
+			return -1;
+		n = ring_reap(engine, completions, max_completions);
+		if (milliseconds == 0)
+			break;
+	}
+	if (engine->to_submit > 0)
+		ring_enter(engine, 0, 0);
+	return n;
+}
+
+/* Set up the ring, fails when the kernel can not do all we need */
+static int ring_setup(struct hid_read_engine *engine, unsigned entries)
+{
+	struct io_uring_params params;
+	struct io_uring_probe *probe;
+	int supported;
+	int fd;
+
+	memset(&params, 0, sizeof(params));
+	fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0)
+		return -1;
+
+	probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+	supported = probe &&
+		syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) >= 0 &&
+		probe->ops_len > IORING_OP_READ &&
+		(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+		(probe->ops[IORING_OP_POLL_ADD].flags & IO_URING_OP_SUPPORTED) &&
+		(probe->ops[IORING_OP_TIMEOUT].flags & IO_URING_OP_SUPPORTED) &&
+		(probe->ops[IORING_OP_ASYNC_CANCEL].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	if (!supported) {
+		close(fd);
+		return -1;
+	}
+
+	engine->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	engine->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (engine->cq_ring_size > engine->sq_ring_size)
+			engine->sq_ring_size = engine->cq_ring_size;
+		engine->cq_ring_size = 0;
+	}
+	engine->sq_ring = mmap(NULL, engine->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (engine->sq_ring == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	if (engine->cq_ring_size) {
+		engine->cq_ring = mmap(NULL, engine->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (engine->cq_ring == MAP_FAILED) {
+			munmap(engine->sq_ring, engine->sq_ring_size);
+			close(fd);
+			return -1;
+		}
+	}
+	else {
+		engine->cq_ring = engine->sq_ring;
+	}
+	engine->sqe_mem_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	engine->sqe_mem = mmap(NULL, engine->sqe_mem_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (engine->sqe_mem == MAP_FAILED) {
+		if (engine->cq_ring_size)
+			munmap(engine->cq_ring, engine->cq_ring_size);
+		munmap(engine->sq_ring, engine->sq_ring_size);
+		close(fd);
+		return -1;
+	}
+
+	engine->ring_fd = fd;
+	engine->sq_head = (unsigned *) ((char *) engine->sq_ring + params.sq_off.head);
+	engine->sq_tail = (unsigned *) ((char *) engine->sq_ring + params.sq_off.tail);
+	engine->sq_mask = *(unsigned *) ((char *) engine->sq_ring + params.sq_off.ring_mask);
+	engine->sq_entries = params.sq_entries;
+	engine->cq_head = (unsigned *) ((char *) engine->cq_ring + params.cq_off.head);
+	engine->cq_tail = (unsigned *) ((char *) engine->cq_ring + params.cq_off.tail);
+	engine->cq_mask = *(unsigned *) ((char *) engine->cq_ring + params.cq_off.ring_mask);
+	engine->sqes = (struct io_uring_sqe *) engine->sqe_mem;
+	engine->cqes = (struct io_uring_cqe *) ((char *) engine->cq_ring + params.cq_off.cqes);
+	{
+		/* Submission entry i always sits in slot i */
+		unsigned *array = (unsigned *) ((char *) engine->sq_ring + params.sq_off.array);
+		unsigned i;
+		for (i = 0; i < params.sq_entries; i++)
+			array[i] = i;
+	}
+	engine->uses_io_uring = 1;
+	return 0;
+}
+
+static void ring_teardown(struct hid_read_engine *engine)
+{
+	munmap(engine->sqe_mem, engine->sqe_mem_size);
+	if (engine->cq_ring_size)
+		munmap(engine->cq_ring, engine->cq_ring_size);
+	munmap(engine->sq_ring, engine->sq_ring_size);
+	close(engine->ring_fd);
+}
+
+#endif /* HAVE_IO_URING */
+
+static int epoll_engine_wait(struct hid_read_engine *engine, struct hid_read_completion *completions, int max_completions, int milliseconds)
+{
+	struct epoll_event events[64];
+	long long deadline = monotonic_ms() + milliseconds;
+	int n = 0;
+
+	if (max_completions > 64)
+		max_completions = 64;
+
+	while (n == 0) {
+		int timeout = milliseconds;
+		int num_events;
+		unsigned long long timestamp;
+		int i;
+		if (milliseconds > 0) {
+			long long left = deadline - monotonic_ms();
+			timeout = (left > 0)? (int) left: 0;
+		}
+		num_events = epoll_wait(engine->epoll_fd, events, max_completions, timeout);
+		if (num_events < 0) {
+			if (errno != EINTR)
+				return -1;
+			num_events = 0;
+		}
+		timestamp = monotonic_ns();
+		for (i = 0; i < num_events; i++) {
+			struct engine_device *entry = events[i].data.ptr;
+			int bytes_read = read(entry->dev->device_handle, entry->buffer, entry->length);
+			if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			completions[n].device = entry->dev;
+			completions[n].user_data = entry->user_data;
+			completions[n].data = entry->buffer;
+			if (bytes_read < 0) {
+				/* The device is gone, stop watching it */
+				epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, entry->dev->device_handle, NULL);
+				entry->failed = 1;
+			}
+			else if (bytes_read > 0 &&
+			         kernel_version < KERNEL_VERSION(2,6,34) &&
+			         entry->dev->uses_numbered_reports) {
+				/* Work around a kernel bug. Chop off the first byte. */
+				memmove(entry->buffer, entry->buffer+1, bytes_read);
+				bytes_read--;
+			}
+			completions[n].bytes_read = bytes_read;
+			if (bytes_read > 0)
+				set_report_info(entry->dev, &completions[n].info, timestamp);
+			else
+				memset(&completions[n].info, 0, sizeof(completions[n].info));
+			n++;
+		}
+		if (milliseconds == 0 || (milliseconds > 0 && monotonic_ms() >= deadline))
+			break;
+	}
+	return n;
+}
+
+struct hid_read_engine HID_API_EXPORT * HID_API_CALL hid_read_engine_new(int max_devices)
+{
+	struct hid_read_engine *engine;
+
+	if (max_devices <= 0)
+		return NULL;
+	engine = calloc(1, sizeof(struct hid_read_engine));
+	if (!engine)
+		return NULL;
+	engine->max_devices = max_devices;
+	engine->devices = calloc(max_devices, sizeof(struct engine_device *));
+	engine->delivered = calloc(max_devices, sizeof(struct engine_device *));
+	engine->epoll_fd = -1;
+	engine->ring_fd = -1;
+	if (!engine->devices || !engine->delivered) {
+		free(engine->devices);
+		free(engine->delivered);
+		free(engine);
+		return NULL;
+	}
+
+#ifdef HAVE_IO_URING
+	/* room for a read per device plus cancels and timeouts */
+	if (ring_setup(engine, 2 * max_devices + 2) == 0)
+		return engine;
+#endif
+	engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (engine->epoll_fd < 0) {
+		free(engine->devices);
+		free(engine->delivered);
+		free(engine);
+		return NULL;
+	}
+	return engine;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_engine_add(struct hid_read_engine *engine, hid_device *dev, size_t length, void *user_data)
+{
+	struct engine_device *entry;
+
+	if (engine->num_devices + engine->num_removed >= engine->max_devices || length == 0)
+		return -1;
+	entry = calloc(1, sizeof(struct engine_device));
+	if (!entry)
+		return -1;
+	entry->buffer = malloc(length);
+	if (!entry->buffer) {
+		free(entry);
+		return -1;
+	}
+	entry->dev = dev;
+	entry->user_data = user_data;
+	entry->length = length;
+
+#ifdef HAVE_IO_URING
+	if (engine->uses_io_uring) {
+		if (ring_queue_read(engine, entry) < 0) {
+			free_engine_device(entry);
+			return -1;
+		}
+	}
+	else
+#endif
+	{
+		/* Read until EAGAIN each time epoll reports the device */
+		struct epoll_event event;
+		if (make_nonblocking(dev) < 0) {
+			free_engine_device(entry);
+			return -1;
+		}
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = entry;
+		if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, dev->device_handle, &event) < 0) {
+			free_engine_device(entry);
+			return -1;
+		}
+	}
+	engine->devices[engine->num_devices++] = entry;
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_engine_remove(struct hid_read_engine *engine, hid_device *dev)
+{
+	struct engine_device *entry = NULL;
+	int i;
+
+	for (i = 0; i < engine->num_devices; i++) {
+		if (engine->devices[i]->dev == dev) {
+			entry = engine->devices[i];
+			engine->devices[i] = engine->devices[--engine->num_devices];
+			break;
+		}
+	}
+	if (!entry)
+		return -1;
+	for (i = 0; i < engine->num_delivered; i++) {
+		if (engine->delivered[i] == entry) {
+			engine->delivered[i] = engine->delivered[--engine->num_delivered];
+			break;
+		}
+	}
+
+#ifdef HAVE_IO_URING
+	if (engine->uses_io_uring && entry->in_flight) {
+		/* The buffer is in use until the read completes */
+		entry->removed = 1;
+		engine->num_removed++;
+		ring_queue_cancel(engine, entry);
+		ring_enter(engine, 0, 0);
+		return 0;
+	}
+#endif
+	if (!engine->uses_io_uring && !entry->failed)
+		epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, dev->device_handle, NULL);
+	free_engine_device(entry);
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_engine_wait(struct hid_read_engine *engine, struct hid_read_completion *completions, int max_completions, int milliseconds)
+{
+	if (max_completions <= 0)
+		return 0;
+#ifdef HAVE_IO_URING
+	if (engine->uses_io_uring)
+		return ring_wait(engine, completions, max_completions, milliseconds);
+#endif
+	return epoll_engine_wait(engine, completions, max_completions, milliseconds);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_engine_uses_io_uring(struct hid_read_engine *engine)
+{
+	return engine->uses_io_uring;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_read_engine_free(struct hid_read_engine *engine)
+{
+	if (!engine)
+		return;
+	while (engine->num_devices > 0)
+		hid_read_engine_remove(engine, engine->devices[0]->dev);
+#ifdef HAVE_IO_URING
+	if (engine->uses_io_uring) {
+		/* Wait for the cancelled reads, their buffers are freed then */
+		struct hid_read_completion completion;
+		while (engine->num_removed > 0) {
+			if (ring_enter(engine, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+				break;
+			ring_reap(engine, &completion, 1);
+		}
+		ring_teardown(engine);
+	}
+#endif
+	if (engine->epoll_fd >= 0)
+		close(engine->epoll_fd);
+	free(engine->devices);
+	free(engine->delivered);
+	free(engine);
+}
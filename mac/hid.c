@@ -30,6 +30,7 @@
 #include <pthread.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <mach/mach_time.h>
 
 #include "hidapi.h"
 
@@ -91,7 +92,7 @@ static int pthread_barrier_wait(pthread_barrier_t *barrier)
 	}
 }
 
-static int return_data(hid_device *dev, unsigned char *data, size_t length);
+static int return_data(hid_device *dev, unsigned char *data, size_t length, struct hid_report_info *info);
 static int drop_data(hid_device *dev);
 
 #define MAX_QUEUE_LEN 30
@@ -100,6 +101,7 @@ static int drop_data(hid_device *dev);
 struct input_report {
 	struct input_report *next;
 	size_t len;
+	struct hid_report_info info; /* taken when the report was delivered */
 	uint8_t data[1];
 };
 
@@ -114,6 +116,7 @@ struct hid_device_ {
 	uint8_t *input_report_buf;
 	CFIndex max_input_report_len;
 	int num_queued_reports;
+	unsigned int input_sequence; /* of the next report that arrives */
 	struct input_report *input_reports;
         struct input_report **last_input_report;
 
@@ -127,6 +130,16 @@ struct hid_device_ {
         int ichan[2];     /* thread write on 1 client poll on 0 */
 };
 
+/* Nanoseconds of the monotonic clock. Without clock_gettime(), this
+   is mach_absolute_time() converted from its timebase. */
+static unsigned long long monotonic_ns(void)
+{
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
 static hid_device *new_hid_device(void)
 {
 	hid_device *dev = calloc(1, sizeof(hid_device));
@@ -580,11 +593,13 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
 {
 	struct input_report *rpt;
 	hid_device *dev = context;
+	unsigned long long timestamp = monotonic_ns();
 
 	/* Make a new Input Report object */
 	rpt = calloc(1, sizeof(struct input_report)+report_length);
 	memcpy(rpt->data, report, report_length);
 	rpt->len = report_length;
+	rpt->info.timestamp = timestamp;
 	rpt->next = NULL;
 
 //	fprintf(stderr, "report: qlen=%d queue=%p report=%p size=%ld\r\n", 
@@ -594,6 +609,10 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
 	/* Lock this section */
 	pthread_mutex_lock(&dev->mutex);
 
+	/* Numbered as it arrives, so that the reports dropped from
+	   a full queue leave a gap */
+	rpt->info.sequence = dev->input_sequence++;
+
 	*dev->last_input_report = rpt;
 	dev->last_input_report = &(rpt->next);
 	dev->num_queued_reports++;
@@ -832,7 +851,7 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 }
 
 /* Helper function, so that this isn't duplicated in hid_read(). */
-static int return_data(hid_device *dev, unsigned char *data, size_t length)
+static int return_data(hid_device *dev, unsigned char *data, size_t length, struct hid_report_info *info)
 {
 	/* Copy the data out of the linked list item (rpt) into the
 	   return buffer (data), and delete the liked list item. */
@@ -842,6 +861,8 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length)
 	    char buf[1];
 
 	    memcpy(data, rpt->data, len);
+	    if (info)
+		*info = rpt->info;
 	    read(dev->ichan[0], buf, 1);  /* clear event */
 	    dev->num_queued_reports--;
 
@@ -908,7 +929,7 @@ static int cond_timedwait(const hid_device *dev, pthread_cond_t *cond, pthread_m
 
 }
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+int HID_API_EXPORT hid_read_timeout_ex(hid_device *dev, unsigned char *data, size_t length, int milliseconds, struct hid_report_info *info)
 {
 	int bytes_read = -1;
 
@@ -918,7 +939,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	/* There's an input report queued up. Return it. */
 	if (dev->input_reports) {
 		/* Return the first one */
-		bytes_read = return_data(dev, data, length);
+		bytes_read = return_data(dev, data, length, info);
 		goto ret;
 	}
 
@@ -943,7 +964,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		int res;
 		res = cond_wait(dev, &dev->condition, &dev->mutex);
 		if (res == 0)
-			bytes_read = return_data(dev, data, length);
+			bytes_read = return_data(dev, data, length, info);
 		else {
 			/* There was an error, or a device disconnection. */
 			bytes_read = -1;
@@ -965,7 +986,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 
 		res = cond_timedwait(dev, &dev->condition, &dev->mutex, &ts);
 		if (res == 0)
-			bytes_read = return_data(dev, data, length);
+			bytes_read = return_data(dev, data, length, info);
 		else if (res == ETIMEDOUT)
 			bytes_read = 0;
 		else
@@ -983,11 +1004,47 @@ ret:
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timeout_ex(dev, data, length, milliseconds, NULL);
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT hid_read_ex(hid_device *dev, unsigned char *data, size_t length, struct hid_report_info *info)
+{
+	return hid_read_timeout_ex(dev, data, length, (dev->blocking)? -1: 0, info);
+}
+
+int HID_API_EXPORT hid_read_batch(hid_device *dev, struct hid_report_slot *slots, int num_slots, int milliseconds)
+{
+	int num_reports = 0;
+	int bytes_read;
+
+	if (num_slots <= 0)
+		return 0;
+
+	/* Wait for the first report as hid_read_timeout() does */
+	bytes_read = hid_read_timeout_ex(dev, slots[0].data, slots[0].length, milliseconds, &slots[0].info);
+	if (bytes_read <= 0)
+		return bytes_read;
+	slots[0].bytes_read = bytes_read;
+	num_reports = 1;
+
+	/* Then take the rest of the list, under one lock */
+	pthread_mutex_lock(&dev->mutex);
+	while (num_reports < num_slots && dev->input_reports) {
+		slots[num_reports].bytes_read = return_data(dev, slots[num_reports].data, slots[num_reports].length, &slots[num_reports].info);
+		num_reports++;
+	}
+	pthread_mutex_unlock(&dev->mutex);
+
+	return num_reports;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	/* All Nonblocking operation is handled by the library. */
@@ -0,0 +1,1229 @@
+/* hidapi_parser $
+ *
+ * Copyright (C) 2013, Marije Baalman <nescivi _at_ gmail.com>
+ * This work was funded by a crowd-funding initiative for SuperCollider's [1] HID implementation
+ * including a substantial donation from BEK, Bergen Center for Electronic Arts, Norway
+ *
+ * [1] http://supercollider.sourceforge.net
+ * [2] http://www.bek.no
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+// regression test of the parser against a fixed report descriptor; the hidapi calls of the
+// parser are answered below, so it runs without a device
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef _WIN32
+	#include <pthread.h>
+#endif
+
+#include <hidapi.h>
+#include "hidapi_parser.h"
+
+#define CACHE_FILE "parsertest.cache"
+
+// joystick with report id 1: a 12 bit x, a signed 10 bit y, 2 bits padding, 8 buttons and 3 key slots;
+// report id 2 is an output report with 8 leds and a vendor byte
+static unsigned char test_descriptor[] = {
+  0x05, 0x01, 0x09, 0x04, 0xA1, 0x01,
+  0x85, 0x01,
+  0x09, 0x30, 0x15, 0x00, 0x26, 0xFF, 0x0F, 0x75, 0x0C, 0x95, 0x01, 0x81, 0x02,
+  0x09, 0x31, 0x16, 0x00, 0xFE, 0x26, 0xFF, 0x01, 0x75, 0x0A, 0x95, 0x01, 0x81, 0x02,
+  0x75, 0x02, 0x95, 0x01, 0x81, 0x01,
+  0x05, 0x09, 0x19, 0x01, 0x29, 0x08, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+  0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x15, 0x00, 0x25, 0x65, 0x75, 0x08, 0x95, 0x03, 0x81, 0x00,
+  0x85, 0x02,
+  0x05, 0x08, 0x19, 0x01, 0x29, 0x08, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x91, 0x02,
+  0x06, 0x00, 0xFF, 0x09, 0x01, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02,
+  0xC0
+};
+
+// gamepad with input report ids 3 (a 16 bit z and 16 buttons) and 4 (a vendor run of 6 bytes),
+// and feature report id 5 with a vendor byte and a 16 bit vendor value
+static unsigned char pad_descriptor[] = {
+  0x05, 0x01, 0x09, 0x05, 0xA1, 0x01,
+  0x85, 0x03,
+  0x09, 0x32, 0x15, 0x00, 0x26, 0xFF, 0x03, 0x75, 0x10, 0x95, 0x01, 0x81, 0x02,
+  0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x10, 0x81, 0x02,
+  0x85, 0x04,
+  0x06, 0x00, 0xFF, 0x09, 0x02, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08, 0x95, 0x06, 0x81, 0x02,
+  0x85, 0x05,
+  0x09, 0x03, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08, 0x95, 0x01, 0xB1, 0x02,
+  0x09, 0x04, 0x15, 0x00, 0x26, 0xE8, 0x03, 0x75, 0x10, 0x95, 0x01, 0xB1, 0x02,
+  0xC0
+};
+
+// what the parser sees of hidapi: the device has the descriptor set with use_descriptor,
+// output reports are kept in written and feature reports in feature
+struct hid_device_ {
+  int unused;
+};
+
+static const unsigned char * stub_descriptor = test_descriptor;
+static int stub_descriptor_size = sizeof( test_descriptor );
+
+static unsigned char written[64];
+static int written_length;
+static int write_count;
+
+static unsigned char feature[64];
+static int feature_length;
+
+hid_device * hid_open( unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number ){
+  (void) vendor_id;
+  (void) product_id;
+  (void) serial_number;
+  return (hid_device *) calloc( 1, sizeof( hid_device ) );
+}
+
+void hid_close( hid_device *device ){
+  free( device );
+}
+
+int hid_get_report_descriptor( hid_device *device, unsigned char *data, size_t length ){
+  (void) device;
+  if ( length < (size_t) stub_descriptor_size ){
+    return -1;
+  }
+  memcpy( data, stub_descriptor, stub_descriptor_size );
+  return stub_descriptor_size;
+}
+
+int hid_write( hid_device *device, const unsigned char *data, size_t length ){
+  (void) device;
+  if ( length > sizeof( written ) ){
+    return -1;
+  }
+  memcpy( written, data, length );
+  written_length = (int) length;
+  write_count++;
+  return (int) length;
+}
+
+int hid_send_feature_report( hid_device *device, const unsigned char *data, size_t length ){
+  (void) device;
+  if ( length > sizeof( feature ) ){
+    return -1;
+  }
+  memcpy( feature, data, length );
+  feature_length = (int) length;
+  return (int) length;
+}
+
+int hid_get_feature_report( hid_device *device, unsigned char *data, size_t length ){
+  (void) device;
+  if ( feature_length == 0 || length < (size_t) feature_length || data[0] != feature[0] ){
+    return -1;
+  }
+  memcpy( data, feature, feature_length );
+  return feature_length;
+}
+
+int hid_set_nonblocking( hid_device *device, int nonblock ){
+  (void) device;
+  (void) nonblock;
+  return 0;
+}
+
+struct hid_device_info * hid_enumerate( unsigned short vendor_id, unsigned short product_id ){
+  (void) vendor_id;
+  (void) product_id;
+  return NULL;
+}
+
+void hid_free_enumeration( struct hid_device_info *devs ){
+  (void) devs;
+}
+
+// opens a device with another descriptor, NULL for the test descriptor
+static struct hid_dev_desc * open_with_descriptor( const unsigned char * descriptor, int size ){
+  if ( descriptor == NULL ){
+    descriptor = test_descriptor;
+    size = sizeof( test_descriptor );
+  }
+  stub_descriptor = descriptor;
+  stub_descriptor_size = size;
+  return hid_open_device( 0x1234, 0x5678, NULL );
+}
+
+static int failures = 0;
+
+#define CHECK( condition ) \
+  do { if ( !( condition ) ){ printf( "%s:%i: check failed: %s\n", __FILE__, __LINE__, #condition ); failures++; } } while ( 0 )
+
+// counts of the callbacks
+static int element_calls;
+static int usage_presses[256];
+static int usage_releases[256];
+
+static void count_element( const struct hid_device_element *element, int value, void *user_data ){
+  (void) element;
+  (void) value;
+  (void) user_data;
+  element_calls++;
+}
+
+static void count_usages( struct hid_dev_desc *devdesc, const struct hid_usage_set *set, const unsigned long long *pressed, const unsigned long long *released, void *user_data ){
+  int usage;
+  (void) devdesc;
+  (void) user_data;
+  for ( usage = set->usage_min; usage <= set->usage_max && usage < 256; usage++ ){
+    int bit = usage - set->usage_min;
+    if ( ( pressed[ bit / 64 ] >> ( bit % 64 ) ) & 1 ){
+      usage_presses[ usage ]++;
+    }
+    if ( ( released[ bit / 64 ] >> ( bit % 64 ) ) & 1 ){
+      usage_releases[ usage ]++;
+    }
+  }
+}
+
+static int report_calls;
+static int report_id;
+static unsigned long long report_timestamp;
+static int report_changes;
+static struct hid_element_change report_change[32];
+
+static void keep_report( struct hid_dev_desc *devdesc, int reportid, unsigned long long timestamp, const struct hid_element_change *changes, int num_changes, void *user_data ){
+  (void) devdesc;
+  (void) user_data;
+  report_calls++;
+  report_id = reportid;
+  report_timestamp = timestamp;
+  report_changes = num_changes;
+  memcpy( report_change, changes, sizeof( struct hid_element_change ) * ( num_changes < 32 ? num_changes : 32 ) );
+}
+
+// the value of an element in the change set of the last report, -99999 if it is not in it
+static int changed_value( int index ){
+  int i;
+  for ( i = 0; i < report_changes && i < 32; i++ ){
+    if ( report_change[i].index == index ){
+      return report_change[i].value;
+    }
+  }
+  return -99999;
+}
+
+static void reset_counts( void ){
+  element_calls = 0;
+  memset( usage_presses, 0, sizeof( usage_presses ) );
+  memset( usage_releases, 0, sizeof( usage_releases ) );
+}
+
+// builds input report 1: x in bits 0-11, y in bits 12-21, then the buttons and keys
+static void make_report( unsigned char * report, int x, int y, int buttons, int key0, int key1, int key2 ){
+  unsigned int axes = ( x & 0xFFF ) | ( ( y & 0x3FF ) << 12 );
+  report[0] = 1;
+  report[1] = axes & 0xFF;
+  report[2] = ( axes >> 8 ) & 0xFF;
+  report[3] = ( axes >> 16 ) & 0xFF;
+  report[4] = buttons;
+  report[5] = key0;
+  report[6] = key1;
+  report[7] = key2;
+}
+
+static int element_value( struct hid_dev_desc * devdesc, int usage_page, int usage, int occurrence ){
+  struct hid_device_element * element = hid_find_element_by_usage( devdesc, usage_page, usage, occurrence );
+  if ( element == NULL ){
+    return -99999;
+  }
+  return hid_get_element_value( devdesc, element->index );
+}
+
+static void test_fields( struct hid_dev_desc * devdesc ){
+  unsigned char report[8];
+  int i;
+
+  make_report( report, 0xABC, -300, 0xA5, 0, 0, 0 );
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  CHECK( element_value( devdesc, 0x01, 0x30, 0 ) == 0xABC );
+  CHECK( element_value( devdesc, 0x01, 0x31, 0 ) == -300 );
+  for ( i = 0; i < 8; i++ ){
+    CHECK( element_value( devdesc, 0x09, i + 1, 0 ) == ( ( 0xA5 >> i ) & 1 ) );
+  }
+
+  // the extremes of both ranges
+  make_report( report, 0xFFF, -512, 0xFF, 0, 0, 0 );
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  CHECK( element_value( devdesc, 0x01, 0x30, 0 ) == 4095 );
+  CHECK( element_value( devdesc, 0x01, 0x31, 0 ) == -512 );
+  CHECK( element_value( devdesc, 0x09, 8, 0 ) == 1 );
+
+  make_report( report, 0, 511, 0, 0, 0, 0 );
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  CHECK( element_value( devdesc, 0x01, 0x30, 0 ) == 0 );
+  CHECK( element_value( devdesc, 0x01, 0x31, 0 ) == 511 );
+  CHECK( element_value( devdesc, 0x09, 1, 0 ) == 0 );
+}
+
+static void test_dispatch( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( pad_descriptor, sizeof( pad_descriptor ) );
+  unsigned char pad_report[5] = { 3, 0x34, 0x02, 0x01, 0x80 };
+  unsigned char vendor_report[7] = { 4, 1, 2, 3, 4, 5, 6 };
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  // io types: input 1, output 2, feature 3
+  CHECK( hid_get_report_layout( devdesc, 1, 3 ) != NULL );
+  CHECK( hid_get_report_layout( devdesc, 1, 4 ) != NULL );
+  CHECK( hid_get_report_layout( devdesc, 1, 5 ) == NULL );
+  CHECK( hid_get_report_layout( devdesc, 3, 5 ) != NULL );
+
+  CHECK( hid_parse_input_report( pad_report, sizeof( pad_report ), devdesc ) == 0 );
+  CHECK( element_value( devdesc, 0x01, 0x32, 0 ) == 0x234 );
+  CHECK( element_value( devdesc, 0x09, 1, 0 ) == 1 );
+  CHECK( element_value( devdesc, 0x09, 2, 0 ) == 0 );
+  CHECK( element_value( devdesc, 0x09, 16, 0 ) == 1 );
+
+  // another report id leaves the values of report 3 alone
+  CHECK( hid_parse_input_report( vendor_report, sizeof( vendor_report ), devdesc ) == 0 );
+  CHECK( element_value( devdesc, 0x01, 0x32, 0 ) == 0x234 );
+
+  // unknown ids, and the id of a feature report, are not decoded
+  vendor_report[0] = 9;
+  CHECK( hid_parse_input_report( vendor_report, sizeof( vendor_report ), devdesc ) == -1 );
+  vendor_report[0] = 5;
+  CHECK( hid_parse_input_report( vendor_report, sizeof( vendor_report ), devdesc ) == -1 );
+  CHECK( hid_parse_input_report( vendor_report, 0, devdesc ) == -1 );
+  hid_close_device( devdesc );
+}
+
+static void test_changes_only( struct hid_dev_desc * devdesc ){
+  unsigned char report[8];
+
+  hid_set_element_callback( devdesc, count_element, NULL );
+  make_report( report, 100, 10, 0x01, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+
+  hid_set_changes_only( devdesc, 1 );
+  reset_counts();
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( element_calls == 0 );
+
+  // x and one button change
+  make_report( report, 101, 10, 0x03, 0, 0, 0 );
+  reset_counts();
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( element_calls == 2 );
+  CHECK( element_value( devdesc, 0x01, 0x30, 0 ) == 101 );
+  CHECK( element_value( devdesc, 0x09, 2, 0 ) == 1 );
+
+  hid_set_changes_only( devdesc, 0 );
+  reset_counts();
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( element_calls > 2 );
+
+  // a report that matches the copy from before the mode was turned on again is still decoded
+  make_report( report, 0, 0, 0, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( hid_set_changes_only( devdesc, 1 ) == 0 );
+  make_report( report, 16, 0, 0x01, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  hid_set_changes_only( devdesc, 0 );
+  make_report( report, 0, 0, 0, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  hid_set_changes_only( devdesc, 1 );
+  make_report( report, 16, 0, 0x01, 0, 0, 0 );
+  reset_counts();
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( element_calls == 2 );
+  CHECK( element_value( devdesc, 0x01, 0x30, 0 ) == 16 );
+  CHECK( element_value( devdesc, 0x09, 1, 0 ) == 1 );
+  hid_set_changes_only( devdesc, 0 );
+  hid_set_element_callback( devdesc, NULL, NULL );
+}
+
+static void test_report_callback( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+  struct hid_device_element * x;
+  struct hid_device_element * y;
+  unsigned char report[8];
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  x = hid_find_element_by_usage( devdesc, 0x01, 0x30, 0 );
+  y = hid_find_element_by_usage( devdesc, 0x01, 0x31, 0 );
+  hid_set_report_callback( devdesc, keep_report, NULL );
+
+  // one call per report, with all the elements of the report
+  report_calls = 0;
+  make_report( report, 200, -20, 0x02, 0, 0, 0 );
+  CHECK( hid_parse_input_report_timed( report, sizeof( report ), devdesc, 1234 ) == 0 );
+  CHECK( report_calls == 1 && report_id == 1 && report_timestamp == 1234 );
+  CHECK( report_changes >= 10 ); // x, y, 8 buttons and the key slots
+  CHECK( changed_value( x->index ) == 200 && changed_value( y->index ) == -20 );
+
+  // with changes-only just the changed ones, and no call for a report without changes
+  hid_set_changes_only( devdesc, 1 );
+  make_report( report, 200, -21, 0x02, 0, 0, 0 );
+  report_calls = 0;
+  hid_parse_input_report_timed( report, sizeof( report ), devdesc, 1235 );
+  CHECK( report_calls == 1 && report_changes == 1 && changed_value( y->index ) == -21 );
+  hid_parse_input_report_timed( report, sizeof( report ), devdesc, 1236 );
+  CHECK( report_calls == 1 );
+  hid_close_device( devdesc );
+}
+
+// the first report after the mode is turned on is compared with the values, not with a zeroed copy
+static void test_changes_only_first_report( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+  unsigned char report[8];
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  make_report( report, 16, 0, 0x01, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( hid_set_changes_only( devdesc, 1 ) == 0 );
+  make_report( report, 0, 0, 0, 0, 0, 0 );
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  CHECK( element_value( devdesc, 0x01, 0x30, 0 ) == 0 );
+  CHECK( element_value( devdesc, 0x09, 1, 0 ) == 0 );
+  hid_close_device( devdesc );
+}
+
+static void test_usage_sets( struct hid_dev_desc * devdesc ){
+  unsigned char report[8];
+
+  CHECK( devdesc->number_of_usage_sets == 1 );
+  hid_set_usage_callback( devdesc, count_usages, NULL );
+
+  make_report( report, 0, 0, 0, 4, 5, 0 );
+  reset_counts();
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( usage_presses[4] == 1 && usage_presses[5] == 1 );
+  CHECK( usage_releases[4] == 0 && usage_releases[5] == 0 );
+  CHECK( hid_usage_is_pressed( devdesc, 0, 4 ) && hid_usage_is_pressed( devdesc, 0, 5 ) );
+
+  // 4 released, 6 pressed, 5 held
+  make_report( report, 0, 0, 0, 5, 6, 0 );
+  reset_counts();
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( usage_releases[4] == 1 && usage_presses[6] == 1 );
+  CHECK( usage_presses[5] == 0 && usage_releases[5] == 0 );
+  CHECK( !hid_usage_is_pressed( devdesc, 0, 4 ) && hid_usage_is_pressed( devdesc, 0, 5 ) && hid_usage_is_pressed( devdesc, 0, 6 ) );
+
+  // rollover (ErrorRollOver in every slot) keeps the keys pressed
+  make_report( report, 0, 0, 0, 1, 1, 1 );
+  reset_counts();
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( usage_releases[5] == 0 && usage_releases[6] == 0 && usage_presses[1] == 0 );
+  CHECK( hid_usage_is_pressed( devdesc, 0, 5 ) && hid_usage_is_pressed( devdesc, 0, 6 ) );
+
+  make_report( report, 0, 0, 0, 0, 0, 0 );
+  reset_counts();
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( usage_releases[5] == 1 && usage_releases[6] == 1 );
+  CHECK( !hid_usage_is_pressed( devdesc, 0, 5 ) && !hid_usage_is_pressed( devdesc, 0, 6 ) );
+  hid_set_usage_callback( devdesc, NULL, NULL );
+}
+
+static void test_output( struct hid_dev_desc * devdesc ){
+  struct hid_device_element * led1 = hid_find_element_by_usage( devdesc, 0x08, 1, 0 );
+  struct hid_device_element * led3 = hid_find_element_by_usage( devdesc, 0x08, 3, 0 );
+  struct hid_device_element * vendor = hid_find_element_by_usage( devdesc, 0xFF00, 1, 0 );
+
+  CHECK( led1 != NULL && led3 != NULL && vendor != NULL );
+  if ( led1 == NULL || led3 == NULL || vendor == NULL ){
+    return;
+  }
+  write_count = 0;
+  CHECK( hid_commit_output_reports( devdesc ) == 0 );
+  CHECK( write_count == 0 );
+
+  CHECK( hid_set_output_value( devdesc, led1, 1 ) == 0 );
+  CHECK( hid_set_output_value( devdesc, led3, 1 ) == 0 );
+  CHECK( hid_set_output_value( devdesc, vendor, 0x5A ) == 0 );
+  CHECK( hid_set_output_value( devdesc, hid_find_element_by_usage( devdesc, 0x01, 0x30, 0 ), 1 ) == -1 ); // an input
+  CHECK( hid_commit_output_reports( devdesc ) >= 0 );
+  CHECK( write_count == 1 );
+  CHECK( written_length == 3 );
+  CHECK( written[0] == 2 && written[1] == 0x05 && written[2] == 0x5A );
+
+  // nothing changed since
+  CHECK( hid_commit_output_reports( devdesc ) == 0 );
+  CHECK( write_count == 1 );
+}
+
+static void test_lookup( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+  struct hid_device_element * element;
+  const int * io_elements;
+  int num_elements;
+  int count;
+  int bad = 0;
+  int i;
+  int j;
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  num_elements = devdesc->descriptor->num_elements;
+  CHECK( hid_get_element( devdesc, -1 ) == NULL && hid_get_element( devdesc, num_elements ) == NULL );
+
+  // every element by index, and by usage with the occurrence of that usage
+  for ( i = 0; i < num_elements; i++ ){
+    int occurrence = 0;
+    element = hid_get_element( devdesc, i );
+    if ( element == NULL || element->index != i ){
+      bad++;
+      continue;
+    }
+    for ( j = 0; j < i; j++ ){
+      if ( devdesc->elements[j].usage_page == element->usage_page && devdesc->elements[j].usage == element->usage ){
+	occurrence++;
+      }
+    }
+    if ( hid_find_element_by_usage( devdesc, element->usage_page, element->usage, occurrence ) != element ){
+      bad++;
+    }
+  }
+  CHECK( bad == 0 );
+  CHECK( hid_find_element_by_usage( devdesc, 0x09, 3, 0 ) == hid_get_element( devdesc, hid_find_element_by_usage( devdesc, 0x09, 1, 0 )->index + 2 ) );
+  CHECK( hid_find_element_by_usage( devdesc, 0x09, 3, 1 ) == NULL );
+  CHECK( hid_find_element_by_usage( devdesc, 0x09, 9, 0 ) == NULL );
+  CHECK( hid_find_element_by_usage( devdesc, 0x02, 0x30, 0 ) == NULL );
+
+  // by io type: 14 inputs (with the padding) and 9 outputs, in descriptor order
+  io_elements = hid_get_io_elements( devdesc, 1, &count );
+  CHECK( count == 14 );
+  for ( i = 0; i < count; i++ ){
+    if ( devdesc->elements[ io_elements[i] ].io_type != 1 || ( i > 0 && io_elements[i] <= io_elements[i-1] ) ){
+      bad++;
+    }
+  }
+  io_elements = hid_get_io_elements( devdesc, 2, &count );
+  CHECK( count == 9 );
+  // the next element of a type, the last one returns itself
+  element = &devdesc->elements[ io_elements[0] ];
+  for ( i = 0; i < count; i++ ){
+    struct hid_device_element * next = hid_get_next_output_element( element );
+    if ( element->index != io_elements[i] || element->io_type != 2 || ( next == element ) != ( i == count - 1 ) ){
+      bad++;
+    }
+    element = next;
+  }
+  CHECK( bad == 0 );
+  CHECK( hid_get_io_elements( devdesc, 3, &count ) != NULL && count == 0 );
+  CHECK( hid_get_io_elements( devdesc, 4, &count ) == NULL && count == 0 );
+  hid_close_device( devdesc );
+}
+
+static void test_subscriptions( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+  struct hid_usage_id usages[3] = { { 0x01, 0x30 }, { 0x09, 2 }, { 0x07, 4 } };
+  unsigned char report[8];
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  make_report( report, 1, 1, 0x00, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+
+  // x, button 2 and the 3 key slots that can report key 4
+  CHECK( hid_subscribe_usages( devdesc, usages, 3 ) == 5 );
+  hid_set_element_callback( devdesc, count_element, NULL );
+  hid_set_usage_callback( devdesc, count_usages, NULL );
+  make_report( report, 300, -3, 0x03, 4, 0, 0 );
+  reset_counts();
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  CHECK( element_calls == 5 );
+  CHECK( element_value( devdesc, 0x01, 0x30, 0 ) == 300 );
+  CHECK( element_value( devdesc, 0x01, 0x31, 0 ) == 1 );
+  CHECK( element_value( devdesc, 0x09, 1, 0 ) == 0 );
+  CHECK( element_value( devdesc, 0x09, 2, 0 ) == 1 );
+  CHECK( usage_presses[4] == 1 && hid_usage_is_pressed( devdesc, 0, 4 ) );
+
+  // no usages decodes everything again
+  CHECK( hid_subscribe_usages( devdesc, NULL, 0 ) == 0 );
+  reset_counts();
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  CHECK( element_calls == 14 );
+  CHECK( element_value( devdesc, 0x01, 0x31, 0 ) == -3 );
+  CHECK( element_value( devdesc, 0x09, 1, 0 ) == 1 );
+  hid_close_device( devdesc );
+}
+
+static void test_byte_runs( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( pad_descriptor, sizeof( pad_descriptor ) );
+  struct hid_device_element * run;
+  unsigned char report[7] = { 4, 10, 20, 30, 40, 50, 60 };
+  const unsigned char * data;
+  int length;
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  // the 6 bytes are one element
+  run = hid_find_element_by_usage( devdesc, 0xFF00, 0x02, 0 );
+  CHECK( run != NULL && run->buffer_size == 6 && run->buffer_offset == 0 );
+  CHECK( hid_find_element_by_usage( devdesc, 0xFF00, 0x02, 1 ) == NULL );
+  if ( run == NULL ){
+    hid_close_device( devdesc );
+    return;
+  }
+  data = hid_get_element_buffer( devdesc, run, &length );
+  CHECK( data == NULL && length == 0 ); // nothing decoded yet
+
+  // a view of the report that was passed in
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  data = hid_get_element_buffer( devdesc, run, &length );
+  CHECK( data == report + 1 && length == 6 );
+  CHECK( hid_get_element_value( devdesc, run->index ) == 6 );
+
+  // in changes-only mode, of the device's copy, which outlives the buffer
+  hid_set_changes_only( devdesc, 1 );
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  report[3] = 0;
+  data = hid_get_element_buffer( devdesc, run, &length );
+  CHECK( data != NULL && data != report + 1 && length == 6 && data[2] == 30 && data[5] == 60 );
+
+  CHECK( hid_set_output_buffer( devdesc, run, report, 6 ) == -1 ); // an input
+  hid_close_device( devdesc );
+}
+
+static void test_bit_runs( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( pad_descriptor, sizeof( pad_descriptor ) );
+  struct hid_device_element * first;
+  const struct hid_bit_run * run;
+  const unsigned long long * state;
+  unsigned long long bits[2] = { 0x8000000000000001ULL, 0x2BULL };
+  unsigned char report[5] = { 3, 0, 0, 0x5A, 0xA5 };
+  unsigned char unpacked[80];
+  int bad = 0;
+  int i;
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  // the 16 buttons are one run
+  first = hid_find_element_by_usage( devdesc, 0x09, 1, 0 );
+  CHECK( first != NULL && devdesc->fields[ first->field_index ].bit_run >= 0 );
+  if ( first == NULL || devdesc->fields[ first->field_index ].bit_run < 0 ){
+    hid_close_device( devdesc );
+    return;
+  }
+  run = &devdesc->bit_runs[ devdesc->fields[ first->field_index ].bit_run ];
+  CHECK( run->num_bits == 16 && run->bit_offset == 16 );
+
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  state = hid_get_bit_run_state( devdesc, run->index );
+  CHECK( state != NULL && ( state[0] & 0xFFFF ) == 0xA55A );
+  for ( i = 0; i < 16; i++ ){
+    if ( element_value( devdesc, 0x09, i + 1, 0 ) != ( ( 0xA55A >> i ) & 1 ) ){
+      bad++;
+    }
+  }
+  CHECK( bad == 0 );
+  CHECK( hid_get_bit_run_state( devdesc, devdesc->number_of_bit_runs ) == NULL );
+
+  // in changes-only mode only the buttons that flipped are called back
+  hid_set_changes_only( devdesc, 1 );
+  hid_set_element_callback( devdesc, count_element, NULL );
+  report[3] = 0x5B;
+  report[4] = 0x25;
+  reset_counts();
+  CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+  CHECK( element_calls == 2 );
+  CHECK( element_value( devdesc, 0x09, 1, 0 ) == 1 && element_value( devdesc, 0x09, 16, 0 ) == 0 );
+
+  // unpacking: the vector part and the tail, across two words
+  hid_unpack_bits( bits, 70, unpacked );
+  for ( i = 0; i < 70; i++ ){
+    if ( unpacked[i] != ( ( bits[ i / 64 ] >> ( i % 64 ) ) & 1 ) ){
+      bad++;
+    }
+  }
+  CHECK( bad == 0 );
+  hid_close_device( devdesc );
+}
+
+#define BATCH_REPORTS 20
+#define BATCH_STRIDE 10
+
+static void test_batch( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+  struct hid_report_layout * layout;
+  unsigned char reports[ BATCH_REPORTS * BATCH_STRIDE ];
+  unsigned long long timestamps[ BATCH_REPORTS ];
+  unsigned long long timestamp_column[ BATCH_REPORTS ];
+  int columns[ 16 * BATCH_REPORTS ];
+  int * x;
+  int * y;
+  int * button3;
+  int * key;
+  int bad = 0;
+  int i;
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  // reports 10 bytes apart, as from a ring of slots
+  memset( reports, 0xEE, sizeof( reports ) );
+  for ( i = 0; i < BATCH_REPORTS; i++ ){
+    make_report( reports + i * BATCH_STRIDE, i * 200, i * 50 - 512, i, i + 4, 0, 0 );
+    timestamps[i] = 1000 + i;
+  }
+  layout = hid_get_report_layout( devdesc, 1, 1 );
+  CHECK( layout->num_fields <= 16 );
+  CHECK( hid_decode_report_batch( devdesc, 1, reports, 8, BATCH_STRIDE, BATCH_REPORTS, timestamps, columns, BATCH_REPORTS, timestamp_column ) == layout->num_fields );
+
+  x = columns + ( hid_find_element_by_usage( devdesc, 0x01, 0x30, 0 )->field_index - layout->first_field ) * BATCH_REPORTS;
+  y = columns + ( hid_find_element_by_usage( devdesc, 0x01, 0x31, 0 )->field_index - layout->first_field ) * BATCH_REPORTS;
+  button3 = columns + ( hid_find_element_by_usage( devdesc, 0x09, 3, 0 )->field_index - layout->first_field ) * BATCH_REPORTS;
+  key = columns + ( hid_find_element_by_usage( devdesc, 0x07, 0, 0 )->field_index - layout->first_field ) * BATCH_REPORTS;
+  for ( i = 0; i < BATCH_REPORTS; i++ ){
+    if ( x[i] != i * 200 || y[i] != i * 50 - 512 || button3[i] != ( ( i >> 2 ) & 1 ) || key[i] != i + 4 || timestamp_column[i] != timestamps[i] ){
+      bad++;
+    }
+  }
+  CHECK( bad == 0 );
+
+  // the elements have the values of the last report
+  CHECK( element_value( devdesc, 0x01, 0x30, 0 ) == ( BATCH_REPORTS - 1 ) * 200 );
+  CHECK( element_value( devdesc, 0x01, 0x31, 0 ) == ( BATCH_REPORTS - 1 ) * 50 - 512 );
+
+  // a report of another id, short reports and short columns
+  reports[ 3 * BATCH_STRIDE ] = 2;
+  CHECK( hid_decode_report_batch( devdesc, 1, reports, 8, BATCH_STRIDE, BATCH_REPORTS, NULL, columns, BATCH_REPORTS, NULL ) == -1 );
+  reports[ 3 * BATCH_STRIDE ] = 1;
+  CHECK( hid_decode_report_batch( devdesc, 1, reports, 7, BATCH_STRIDE, BATCH_REPORTS, NULL, columns, BATCH_REPORTS, NULL ) == -1 );
+  CHECK( hid_decode_report_batch( devdesc, 1, reports, 8, BATCH_STRIDE, BATCH_REPORTS, NULL, columns, BATCH_REPORTS - 1, NULL ) == -1 );
+  CHECK( hid_decode_report_batch( devdesc, 2, reports, 8, BATCH_STRIDE, BATCH_REPORTS, NULL, columns, BATCH_REPORTS, NULL ) == -1 );
+  hid_close_device( devdesc );
+}
+
+// a stand-in for a generated decoder, for the test descriptor with y limited to 0..255:
+// every field decodes as 7
+static int decoder_calls;
+
+static int decode_sevens( const unsigned char *data, int size, int report_id, int *values ){
+  int i;
+  (void) data;
+  (void) size;
+  decoder_calls++;
+  if ( report_id != 1 ){
+    return -1;
+  }
+  for ( i = 0; i < 14; i++ ){
+    values[i] = 7;
+  }
+  return 14;
+}
+
+static void test_decoder( void ){
+  static unsigned char decoder_descriptor[ sizeof( test_descriptor ) ];
+  unsigned char other_descriptor[ sizeof( test_descriptor ) ];
+  struct hid_dev_desc * devdesc;
+  unsigned char report[8];
+  unsigned char * y_max;
+
+  // the same size, the y maximum differs
+  memcpy( decoder_descriptor, test_descriptor, sizeof( test_descriptor ) );
+  y_max = memchr( decoder_descriptor + 20, 0x26, sizeof( test_descriptor ) - 20 );
+  CHECK( y_max != NULL && y_max[1] == 0xFF && y_max[2] == 0x01 );
+  if ( y_max == NULL ){
+    return;
+  }
+  y_max[2] = 0x00;
+  memcpy( other_descriptor, decoder_descriptor, sizeof( test_descriptor ) );
+  other_descriptor[ y_max - decoder_descriptor + 1 ] = 0xFE;
+  CHECK( hid_register_decoder( decoder_descriptor, sizeof( decoder_descriptor ), decode_sevens ) == 0 );
+  make_report( report, 100, 10, 0, 0, 0, 0 );
+
+  // only devices with exactly the registered descriptor use the decoder
+  devdesc = open_with_descriptor( decoder_descriptor, sizeof( decoder_descriptor ) );
+  CHECK( devdesc != NULL && devdesc->_decoder == decode_sevens );
+  if ( devdesc != NULL ){
+    decoder_calls = 0;
+    CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+    CHECK( decoder_calls == 1 && element_value( devdesc, 0x01, 0x30, 0 ) == 7 );
+    hid_close_device( devdesc );
+  }
+  devdesc = open_with_descriptor( other_descriptor, sizeof( other_descriptor ) );
+  CHECK( devdesc != NULL && devdesc->_decoder == NULL );
+  if ( devdesc != NULL ){
+    decoder_calls = 0;
+    CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+    CHECK( decoder_calls == 0 && element_value( devdesc, 0x01, 0x30, 0 ) == 100 );
+    hid_close_device( devdesc );
+  }
+  devdesc = open_with_descriptor( NULL, 0 );
+  CHECK( devdesc != NULL && devdesc->_decoder == NULL );
+  if ( devdesc != NULL ){
+    hid_close_device( devdesc );
+  }
+}
+
+static void test_values( void ){
+  struct hid_dev_desc * first = open_with_descriptor( NULL, 0 );
+  struct hid_dev_desc * second = open_with_descriptor( NULL, 0 );
+  struct hid_device_element * x;
+  unsigned char report[8];
+
+  CHECK( first != NULL && second != NULL );
+  if ( first == NULL || second == NULL ){
+    return;
+  }
+  // the elements are shared and only read, the values are per device
+  CHECK( first->elements == second->elements && first->values != second->values );
+  x = hid_find_element_by_usage( first, 0x01, 0x30, 0 );
+  make_report( report, 1000, -100, 0xFF, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), first );
+  make_report( report, 2000, 100, 0x00, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), second );
+  CHECK( hid_get_element_value( first, x->index ) == 1000 && hid_get_element_value( second, x->index ) == 2000 );
+  CHECK( element_value( first, 0x09, 5, 0 ) == 1 && element_value( second, 0x09, 5, 0 ) == 0 );
+
+  hid_element_set_rawvalue( first, x, 4000 );
+  CHECK( hid_get_element_value( first, x->index ) == 4000 && hid_get_element_value( second, x->index ) == 2000 );
+  hid_element_set_logicalvalue( second, x, 0.5f );
+  CHECK( hid_get_element_value( second, x->index ) == 2047 );
+  CHECK( hid_get_element_value( first, -1 ) == 0 && hid_get_element_value( first, first->descriptor->num_elements ) == 0 );
+  hid_close_device( first );
+  hid_close_device( second );
+}
+
+// x and y of the reports of the snapshot test always satisfy y + 512 == x % 1024,
+// the last report has x 4095
+#define SNAPSHOT_REPORTS 20000
+
+struct snapshot_reader {
+  struct hid_dev_desc * devdesc;
+  int indices[2];
+  int snapshots;
+  int torn;
+};
+
+static void * read_snapshots( void * arg ){
+  struct snapshot_reader * reader = (struct snapshot_reader *) arg;
+  int values[2] = { 0, 0 };
+  while ( values[0] != 4095 ){
+    unsigned int sequence = hid_snapshot_values( reader->devdesc, reader->indices, 2, values );
+    if ( ( sequence & 1 ) != 0 || values[1] + 512 != values[0] % 1024 ){
+      reader->torn++;
+    }
+    reader->snapshots++;
+  }
+  return NULL;
+}
+
+static void test_snapshots( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+  struct snapshot_reader reader;
+  struct hid_report_layout * layout;
+  unsigned char report[8];
+  unsigned int sequence;
+  int values[32];
+  int bad = 0;
+  int i;
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  reader.devdesc = devdesc;
+  reader.indices[0] = hid_find_element_by_usage( devdesc, 0x01, 0x30, 0 )->index;
+  reader.indices[1] = hid_find_element_by_usage( devdesc, 0x01, 0x31, 0 )->index;
+  reader.snapshots = 0;
+  reader.torn = 0;
+  make_report( report, 0, -512, 0, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+
+  // the sequence is even between reports and grows by 2 with each
+  sequence = hid_get_values_sequence( devdesc );
+  CHECK( ( sequence & 1 ) == 0 );
+  make_report( report, 1030, 6 - 512, 0x10, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( hid_get_values_sequence( devdesc ) == sequence + 2 );
+  layout = hid_get_report_layout( devdesc, 1, 1 );
+  CHECK( hid_snapshot_report_values( devdesc, layout, values ) == sequence + 2 );
+  for ( i = 0; i < layout->num_fields && i < 32; i++ ){
+    if ( values[i] != hid_get_element_value( devdesc, devdesc->fields[ layout->first_field + i ].element_index ) ){
+      bad++;
+    }
+  }
+  CHECK( bad == 0 );
+  CHECK( hid_snapshot_values( devdesc, NULL, 2, values ) == sequence + 2 && values[0] == 1030 && values[1] == 6 - 512 );
+
+#ifndef _WIN32
+  {
+    // another thread never sees x and y of different reports
+    pthread_t thread;
+    CHECK( pthread_create( &thread, NULL, read_snapshots, &reader ) == 0 );
+    for ( i = 0; i < SNAPSHOT_REPORTS; i++ ){
+      make_report( report, i % 4095, ( i % 4095 ) % 1024 - 512, i, 0, 0, 0 );
+      hid_parse_input_report( report, sizeof( report ), devdesc );
+    }
+    make_report( report, 4095, 4095 % 1024 - 512, 0, 0, 0, 0 );
+    hid_parse_input_report( report, sizeof( report ), devdesc );
+    pthread_join( thread, NULL );
+    CHECK( reader.torn == 0 && reader.snapshots > 0 );
+  }
+#else
+  (void) read_snapshots;
+#endif
+  hid_close_device( devdesc );
+}
+
+static int near( float a, float b ){
+  return a - b < 1e-4f && b - a < 1e-4f;
+}
+
+static void test_mapping( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+  struct hid_report_layout * layout;
+  struct hid_device_element * x;
+  struct hid_device_element * y;
+  unsigned char report[8];
+  float logical[32];
+  float physical[32];
+  int bad = 0;
+  int n;
+  int i;
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  x = hid_find_element_by_usage( devdesc, 0x01, 0x30, 0 );
+  y = hid_find_element_by_usage( devdesc, 0x01, 0x31, 0 );
+  CHECK( near( hid_element_map_logical( x, 0 ), 0 ) && near( hid_element_map_logical( x, 4095 ), 1 ) );
+  CHECK( near( hid_element_map_logical( y, -512 ), 0 ) && near( hid_element_map_logical( y, 511 ), 1 ) );
+
+  // the whole report at once, by field, the same as one element at a time
+  make_report( report, 4095, -512, 0x81, 4, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  layout = hid_get_report_layout( devdesc, 1, 1 );
+  n = hid_map_report_values( devdesc, layout, logical, 0 );
+  CHECK( n == layout->num_fields && n <= 32 );
+  hid_map_report_values( devdesc, layout, physical, 1 );
+  for ( i = 0; i < n && i < 32; i++ ){
+    struct hid_device_element * element = hid_get_element( devdesc, devdesc->fields[ layout->first_field + i ].element_index );
+    int value = hid_get_element_value( devdesc, element->index );
+    if ( !near( logical[i], hid_element_map_logical( element, value ) ) || !near( physical[i], hid_element_map_physical( element, value ) ) ){
+      bad++;
+    }
+  }
+  CHECK( bad == 0 );
+  CHECK( near( logical[ x->field_index - layout->first_field ], 1 ) && near( logical[ y->field_index - layout->first_field ], 0 ) );
+  hid_close_device( devdesc );
+}
+
+static void test_conditioning( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+  struct hid_device_element * x;
+  struct hid_device_element * y;
+  struct hid_device_element * button;
+  float table[1024];
+  unsigned char report[8];
+  int i;
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  x = hid_find_element_by_usage( devdesc, 0x01, 0x30, 0 );
+  y = hid_find_element_by_usage( devdesc, 0x01, 0x31, 0 );
+  button = hid_find_element_by_usage( devdesc, 0x09, 2, 0 );
+  CHECK( hid_get_conditioned_values( devdesc, hid_get_report_layout( devdesc, 1, 1 ) ) == NULL );
+
+  // x: a deadzone of 0.1 around the middle, the rest is stretched to the full range again
+  CHECK( hid_set_deadzone( devdesc, x, 0.1f, 0.5f ) == 0 );
+  CHECK( hid_set_deadzone( devdesc, x, 0.5f, 0.5f ) == -1 );
+  CHECK( hid_set_deadzone( devdesc, hid_find_element_by_usage( devdesc, 0x08, 1, 0 ), 0.1f, 0.5f ) == -1 ); // an output
+  // y: a calibration table that maps the raw value -512..511 to 0..0.5
+  for ( i = 0; i < 1024; i++ ){
+    table[i] = i / 2048.0f;
+  }
+  CHECK( hid_set_calibration( devdesc, y, table, 1023 ) == -1 );
+  CHECK( hid_set_calibration( devdesc, y, table, 1024 ) == 0 );
+  // button 2: smoothed by half
+  CHECK( hid_set_smoothing( devdesc, button, 0.5f ) == 0 );
+  CHECK( hid_set_smoothing( devdesc, button, 0.0f ) == -1 );
+
+  // the first report sets the smoothed values directly
+  make_report( report, 2252, 0, 0x00, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( near( hid_get_conditioned_value( devdesc, x ), 0.5f ) );
+  CHECK( near( hid_get_conditioned_value( devdesc, y ), 512 / 2048.0f ) );
+  CHECK( near( hid_get_conditioned_value( devdesc, button ), 0 ) );
+  CHECK( hid_get_conditioned_values( devdesc, hid_get_report_layout( devdesc, 1, 1 ) ) != NULL );
+
+  make_report( report, 4095, -512, 0x02, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( near( hid_get_conditioned_value( devdesc, x ), 1.0f ) );
+  CHECK( near( hid_get_conditioned_value( devdesc, y ), 0 ) );
+  CHECK( near( hid_get_conditioned_value( devdesc, button ), 0.5f ) );
+
+  // in changes-only mode a repeated report still smooths
+  hid_set_changes_only( devdesc, 1 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( near( hid_get_conditioned_value( devdesc, button ), 0.875f ) );
+
+  // without the table y is mapped to 0..1 again
+  CHECK( hid_set_calibration( devdesc, y, NULL, 0 ) == 0 );
+  make_report( report, 0, 511, 0x02, 0, 0, 0 );
+  hid_parse_input_report( report, sizeof( report ), devdesc );
+  CHECK( near( hid_get_conditioned_value( devdesc, x ), 0 ) );
+  CHECK( near( hid_get_conditioned_value( devdesc, y ), 1.0f ) );
+  hid_close_device( devdesc );
+}
+
+static void test_feature( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( pad_descriptor, sizeof( pad_descriptor ) );
+  struct hid_device_element * byte;
+  struct hid_device_element * word;
+  unsigned char report[4] = { 5, 0x22, 0x10, 0x00 };
+  int writes;
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return;
+  }
+  byte = hid_find_element_by_usage( devdesc, 0xFF00, 0x03, 0 );
+  word = hid_find_element_by_usage( devdesc, 0xFF00, 0x04, 0 );
+  CHECK( byte != NULL && word != NULL && byte->io_type == 3 && word->io_type == 3 );
+  if ( byte == NULL || word == NULL ){
+    hid_close_device( devdesc );
+    return;
+  }
+
+  // read from the device
+  feature[0] = 5;
+  feature[1] = 0x11;
+  feature[2] = 0x34;
+  feature[3] = 0x02;
+  feature_length = 4;
+  CHECK( hid_read_feature_report( devdesc, 5 ) == 0 );
+  CHECK( hid_get_element_value( devdesc, byte->index ) == 0x11 );
+  CHECK( hid_get_element_value( devdesc, word->index ) == 0x234 );
+  CHECK( hid_read_feature_report( devdesc, 3 ) == -1 ); // an input report
+
+  // decoded from a buffer
+  CHECK( hid_parse_feature_report( report, sizeof( report ), devdesc ) == 0 );
+  CHECK( hid_get_element_value( devdesc, byte->index ) == 0x22 );
+  CHECK( hid_get_element_value( devdesc, word->index ) == 0x10 );
+
+  // a changed value is sent on top of the report read from the device, as a feature report
+  writes = write_count;
+  feature_length = 0;
+  CHECK( hid_set_output_value( devdesc, word, 1000 ) == 0 );
+  CHECK( hid_commit_output_reports( devdesc ) == 1 );
+  CHECK( write_count == writes );
+  CHECK( feature_length == 4 && feature[0] == 5 && feature[1] == 0x11 && feature[2] == 0xE8 && feature[3] == 0x03 );
+
+  // all current values
+  hid_element_set_rawvalue( devdesc, byte, 0x7F );
+  feature_length = 0;
+  CHECK( hid_send_feature_values( devdesc, 5 ) >= 0 );
+  CHECK( feature_length == 4 && feature[1] == 0x7F && feature[2] == 0xE8 && feature[3] == 0x03 );
+  CHECK( hid_send_feature_values( devdesc, 4 ) == -1 );
+  hid_close_device( devdesc );
+}
+
+static long file_size( FILE * file ){
+  long size;
+  fseek( file, 0, SEEK_END );
+  size = ftell( file );
+  fseek( file, 0, SEEK_SET );
+  return size;
+}
+
+// rewrites the cache file with an int of the stored descriptor block set to value, at offset
+// from the start of the block, or cut short when offset is -1
+static int corrupt_cache_file( const struct hid_device_descriptor * descriptor, long offset, int value ){
+  FILE * file = fopen( CACHE_FILE, "rb" );
+  unsigned char * data;
+  long size;
+  long start;
+  int ok;
+
+  if ( file == NULL ){
+    return 0;
+  }
+  size = file_size( file );
+  data = (unsigned char *) malloc( size );
+  ok = data != NULL && fread( data, 1, size, file ) == (size_t) size;
+  fclose( file );
+  if ( !ok ){
+    free( data );
+    return 0;
+  }
+  if ( offset < 0 ){
+    size -= 8;
+  } else {
+    // the block is stored as it is in memory
+    for ( start = 0; start + descriptor->size <= size; start += 8 ){
+      if ( memcmp( data + start, descriptor, descriptor->size ) == 0 ){
+	break;
+      }
+    }
+    if ( start + descriptor->size > size ){
+      free( data );
+      return 0;
+    }
+    memcpy( data + start + offset, &value, sizeof( int ) );
+  }
+  file = fopen( CACHE_FILE, "wb" );
+  ok = file != NULL && fwrite( data, 1, size, file ) == (size_t) size;
+  if ( file != NULL ){
+    fclose( file );
+  }
+  free( data );
+  return ok;
+}
+
+// offset of a member of a field in the descriptor block
+static long field_offset( const struct hid_device_descriptor * descriptor, int field_index, size_t member ){
+  return descriptor->fields_offset + field_index * (long) sizeof( struct hid_report_field ) + (long) member;
+}
+
+static struct hid_device_descriptor * copy_descriptor( const struct hid_device_descriptor * descriptor ){
+  struct hid_device_descriptor * copy = (struct hid_device_descriptor *) malloc( descriptor->size );
+  memcpy( copy, descriptor, descriptor->size );
+  return copy;
+}
+
+static void test_cache( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+  struct hid_dev_desc * pad = open_with_descriptor( pad_descriptor, sizeof( pad_descriptor ) );
+  struct hid_device_descriptor * copy;
+  struct hid_device_descriptor * pad_copy;
+  struct hid_device_element * run;
+  int run_field = -1;
+  int run_size = 0;
+  unsigned char report[8];
+
+  CHECK( devdesc != NULL && pad != NULL );
+  if ( devdesc == NULL || pad == NULL ){
+    return;
+  }
+  CHECK( hid_save_descriptor_cache( CACHE_FILE ) == 2 );
+  copy = copy_descriptor( devdesc->descriptor );
+  pad_copy = copy_descriptor( pad->descriptor );
+  run = hid_find_element_by_usage( pad, 0xFF00, 0x02, 0 );
+  if ( run != NULL ){
+    run_field = run->field_index;
+    run_size = run->buffer_size;
+  }
+  hid_close_device( devdesc );
+  hid_close_device( pad );
+
+  CHECK( hid_load_descriptor_cache( CACHE_FILE ) == 2 );
+  devdesc = open_with_descriptor( NULL, 0 );
+  CHECK( devdesc != NULL );
+  if ( devdesc != NULL ){
+    CHECK( hid_unload_descriptor_cache() == -1 ); // the device uses the loaded descriptor
+    make_report( report, 0x123, -2, 0x80, 7, 0, 0 );
+    CHECK( hid_parse_input_report( report, sizeof( report ), devdesc ) == 0 );
+    CHECK( element_value( devdesc, 0x01, 0x30, 0 ) == 0x123 );
+    CHECK( element_value( devdesc, 0x01, 0x31, 0 ) == -2 );
+    CHECK( element_value( devdesc, 0x09, 8, 0 ) == 1 );
+    CHECK( hid_usage_is_pressed( devdesc, 0, 7 ) );
+    hid_close_device( devdesc );
+  }
+  CHECK( hid_unload_descriptor_cache() == 0 );
+
+  // a field pointing past the elements
+  CHECK( corrupt_cache_file( copy, field_offset( copy, 0, offsetof( struct hid_report_field, element_index ) ), copy->num_elements ) );
+  CHECK( hid_load_descriptor_cache( CACHE_FILE ) == -1 );
+  // a field without bits
+  devdesc = open_with_descriptor( NULL, 0 );
+  pad = open_with_descriptor( pad_descriptor, sizeof( pad_descriptor ) );
+  CHECK( hid_save_descriptor_cache( CACHE_FILE ) == 2 );
+  CHECK( corrupt_cache_file( copy, field_offset( copy, 0, offsetof( struct hid_report_field, bit_size ) ), 0 ) );
+  CHECK( hid_load_descriptor_cache( CACHE_FILE ) == -1 );
+  // a byte run whose field does not match its buffer
+  CHECK( run_field >= 0 && run_size == 6 );
+  CHECK( hid_save_descriptor_cache( CACHE_FILE ) == 2 );
+  if ( run_field >= 0 ){
+    CHECK( corrupt_cache_file( pad_copy, field_offset( pad_copy, run_field, offsetof( struct hid_report_field, bit_size ) ), 8 * run_size - 8 ) );
+    CHECK( hid_load_descriptor_cache( CACHE_FILE ) == -1 );
+  }
+  // a truncated file
+  CHECK( hid_save_descriptor_cache( CACHE_FILE ) == 2 );
+  CHECK( corrupt_cache_file( copy, -1, 0 ) );
+  CHECK( hid_load_descriptor_cache( CACHE_FILE ) == -1 );
+  CHECK( hid_unload_descriptor_cache() == 0 );
+  hid_close_device( devdesc );
+  hid_close_device( pad );
+
+  // the device still parses its own descriptor
+  devdesc = open_with_descriptor( NULL, 0 );
+  CHECK( devdesc != NULL );
+  if ( devdesc != NULL ){
+    CHECK( devdesc->descriptor->size == copy->size );
+    hid_close_device( devdesc );
+  }
+  free( copy );
+  free( pad_copy );
+  remove( CACHE_FILE );
+}
+
+int main( void ){
+  struct hid_dev_desc * devdesc = open_with_descriptor( NULL, 0 );
+
+  CHECK( devdesc != NULL );
+  if ( devdesc == NULL ){
+    return 1;
+  }
+  test_fields( devdesc );
+  test_changes_only( devdesc );
+  test_usage_sets( devdesc );
+  test_output( devdesc );
+  hid_close_device( devdesc );
+
+  test_dispatch();
+  test_report_callback();
+  test_mapping();
+  test_lookup();
+  test_subscriptions();
+  test_byte_runs();
+  test_bit_runs();
+  test_batch();
+  test_decoder();
+  test_values();
+  test_snapshots();
+  test_conditioning();
+  test_feature();
+  test_changes_only_first_report();
+  test_cache();
+
+  if ( failures > 0 ){
+    printf( "%i checks failed\n", failures );
+    return 1;
+  }
+  printf( "all checks passed\n" );
+  return 0;
+}
@@ -132,8 +132,22 @@ struct hid_device_ {
 		BOOL read_pending;
 		char *read_buf;
 		OVERLAPPED ol;
+		unsigned int sequence; /* of the next report that is read */
 };
 
+/* Nanoseconds of the performance counter, the monotonic clock here */
+static unsigned long long monotonic_ns(void)
+{
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	/* In two parts, so that the multiplication does not overflow */
+	return (unsigned long long) (counter.QuadPart / frequency.QuadPart) * 1000000000ULL +
+		(unsigned long long) (counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+}
+
 static hid_device *new_hid_device()
 {
 	hid_device *dev = (hid_device*) calloc(1, sizeof(hid_device));
@@ -655,7 +669,7 @@ end_of_function:
 }
 
 
-int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+int HID_API_EXPORT HID_API_CALL hid_read_timeout_ex(hid_device *dev, unsigned char *data, size_t length, int milliseconds, struct hid_report_info *info)
 {
 	DWORD bytes_read = 0;
 	BOOL res;
@@ -700,6 +714,12 @@ int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char
 	dev->read_pending = FALSE;
 
 	if (res && bytes_read > 0) {
+		if (info) {
+			info->timestamp = monotonic_ns();
+			info->sequence = dev->sequence;
+		}
+		dev->sequence++;
+
 		if (dev->read_buf[0] == 0x0) {
 			/* If report numbers aren't being used, but Windows sticks a report
 			   number (0x0) on the beginning of the report anyway. To make this
@@ -726,11 +746,48 @@ end_of_function:
 	return bytes_read;
 }
 
+int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timeout_ex(dev, data, length, milliseconds, NULL);
+}
+
 int HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT HID_API_CALL hid_read_ex(hid_device *dev, unsigned char *data, size_t length, struct hid_report_info *info)
+{
+	return hid_read_timeout_ex(dev, data, length, (dev->blocking)? -1: 0, info);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_batch(hid_device *dev, struct hid_report_slot *slots, int num_slots, int milliseconds)
+{
+	int num_reports = 0;
+	int bytes_read;
+
+	if (num_slots <= 0)
+		return 0;
+
+	/* Wait for the first report, then take the ones that are already
+	   there without waiting */
+	bytes_read = hid_read_timeout_ex(dev, slots[0].data, slots[0].length, milliseconds, &slots[0].info);
+	if (bytes_read <= 0)
+		return bytes_read;
+	slots[0].bytes_read = bytes_read;
+	num_reports = 1;
+
+	while (num_reports < num_slots) {
+		bytes_read = hid_read_timeout_ex(dev, slots[num_reports].data, slots[num_reports].length, 0, &slots[num_reports].info);
+		if (bytes_read <= 0)
+			break;
+		slots[num_reports].bytes_read = bytes_read;
+		num_reports++;
+	}
+
+	return num_reports;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;